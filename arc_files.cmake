@@ -0,0 +1,99 @@
+MACRO(EXECUTE_PROGRAM)
+  EXECUTE_PROCESS(COMMAND ${ARGV} RESULT_VARIABLE res)
+  IF (res)
+    MESSAGE(FATAL_ERROR "${ARGV} failed: " ${res})
+  ENDIF()
+ENDMACRO()
+MACRO(CBMCONVERT)
+  EXECUTE_PROGRAM(${CBMCONVERT} ${ARGV})
+ENDMACRO()
+FUNCTION(REPEAT var str count)
+  SET(result "")
+  SET(n ${count})
+  WHILE(n GREATER 0)
+    MATH(EXPR bit "${n} % 2")
+    IF (bit)
+      SET(result "${result}${str}")
+    ENDIF()
+    SET(str "${str}${str}")
+    MATH(EXPR n "${n} / 2")
+  ENDWHILE()
+  SET(${var} "${result}" PARENT_SCOPE)
+ENDFUNCTION()
+
+# Each archive consists of 3 packed (run-length encoded) ARC64 version 1
+# members of 65793 identical bytes.  The headers are chosen so that they
+# do not contain any NUL bytes.  Each member is padded to 0x101 blocks.
+STRING(ASCII 1 1 version_mode)
+STRING(ASCII 1 1 1 size)
+STRING(ASCII 1 1 blocks)
+STRING(ASCII 2 fnlen)
+STRING(ASCII 254 count)
+SET(archives)
+FOREACH(i RANGE 1 16)
+  MATH(EXPR ctrl "32 + ${i}")
+  STRING(ASCII ${ctrl} ctrl)
+  MATH(EXPR letter "64 + ${i}")
+  STRING(ASCII ${letter} letter)
+  STRING(TOLOWER ${letter} name)
+  SET(arc)
+  FOREACH(j RANGE 1 3)
+    MATH(EXPR c "64 + (${i} * 3 + ${j}) % 26")
+    STRING(ASCII ${c} c)
+    # 65793 = 259 * 254 + 7; the checksum is 65793 * c = 0x101 * c
+    REPEAT(data "${ctrl}${count}${c}" 259)
+    REPEAT(pad "x" 64480) # 0x101 * 254 - 14 - 784
+    SET(arc "${arc}${version_mode}${c}${c}${size}${blocks}P${fnlen}${letter}${j}")
+    SET(arc "${arc}${ctrl}${data}${c}${c}${c}${c}${c}${c}${c}${pad}")
+    REPEAT(data "${c}" 65793)
+    FILE(WRITE ${name}${j}.expected "${data}")
+    FILE(REMOVE ${name}${j}.prg)
+  ENDFOREACH()
+  FILE(WRITE ${i}.arc "${arc}")
+  LIST(APPEND archives ${i}.arc)
+  MATH(EXPR bit "${i} % 4")
+  IF (NOT bit)
+    LIST(APPEND archives ${ARC_MODES})
+  ENDIF()
+ENDFOREACH()
+
+# Every fourth archive is followed by ${ARC_MODES}, whose members
+# are in modes 2, 3, 4 and 5.  The contents are as in arc_modes.cmake.
+SET(data "")
+FOREACH(i RANGE 1 1000)
+  SET(data "${data}line ${i}\n")
+ENDFOREACH()
+REPEAT(dashes "-" 1000)
+STRING(ASCII 254 254 254 ctrl)
+FOREACH(i RANGE 1 255)
+  LIST(APPEND b ${i})
+ENDFOREACH()
+LIST(REMOVE_ITEM b 59)
+STRING(ASCII ${b} b)
+FILE(WRITE modes.expected "${data}${dashes}${ctrl}${b}")
+SET(modes squeezed.seq crunched.prg squashed.usr onepass.prg)
+FOREACH(suffix "" ~0 ~1 ~2)
+  FOREACH(name ${modes})
+    STRING(REPLACE "." "${suffix}." name ${name})
+    LIST(APPEND modes_out ${name})
+  ENDFOREACH()
+ENDFOREACH()
+FILE(REMOVE ${modes_out})
+
+CBMCONVERT(-N -j 4 -a ${archives})
+
+FOREACH(i RANGE 1 16)
+  MATH(EXPR letter "96 + ${i}")
+  STRING(ASCII ${letter} name)
+  FOREACH(j RANGE 1 3)
+    EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files
+      ${name}${j}.prg ${name}${j}.expected)
+    FILE(REMOVE ${name}${j}.prg ${name}${j}.expected)
+  ENDFOREACH()
+  FILE(REMOVE ${i}.arc)
+ENDFOREACH()
+FOREACH(name ${modes_out})
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files
+    ${name} modes.expected)
+ENDFOREACH()
+FILE(REMOVE ${modes_out} modes.expected)
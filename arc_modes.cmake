@@ -0,0 +1,55 @@
+MACRO(EXECUTE_PROGRAM)
+  EXECUTE_PROCESS(COMMAND ${ARGV} RESULT_VARIABLE res)
+  IF (res)
+    MESSAGE(FATAL_ERROR "${ARGV} failed: " ${res})
+  ENDIF()
+ENDMACRO()
+FUNCTION(REPEAT var str count)
+  SET(result "")
+  SET(n ${count})
+  WHILE(n GREATER 0)
+    MATH(EXPR bit "${n} % 2")
+    IF (bit)
+      SET(result "${result}${str}")
+    ENDIF()
+    SET(str "${str}${str}")
+    MATH(EXPR n "${n} / 2")
+  ENDWHILE()
+  SET(${var} "${result}" PARENT_SCOPE)
+ENDFUNCTION()
+
+# The archive ${ARC_MODES} consists of 4 ARC64 version 2 members of the
+# same contents: squeezed,seq (mode 2, Huffman coded), crunched,prg
+# (mode 3, run-length and LZW coded), squashed,usr (mode 4, run-length
+# and Huffman coded) and onepass,prg (mode 5, one-pass crunched).
+# The contents make the Huffman codes longer than 10 bits and the LZW
+# codes grow to 12 bits.  Runs longer than 256 bytes and the run-length
+# control byte 254 are present in the contents.
+SET(data "")
+FOREACH(i RANGE 1 1000)
+  SET(data "${data}line ${i}\n")
+ENDFOREACH()
+REPEAT(dashes "-" 1000)
+STRING(ASCII 254 254 254 ctrl)
+FOREACH(i RANGE 1 255)
+  LIST(APPEND b ${i})
+ENDFOREACH()
+LIST(REMOVE_ITEM b 59)
+STRING(ASCII ${b} b)
+FILE(WRITE arc_modes.expected "${data}${dashes}${ctrl}${b}")
+
+FILE(REMOVE_RECURSE arc_modes)
+FILE(MAKE_DIRECTORY arc_modes)
+EXECUTE_PROCESS(COMMAND ${CBMCONVERT} -N -a ${ARC_MODES}
+  WORKING_DIRECTORY arc_modes
+  OUTPUT_VARIABLE out ERROR_VARIABLE out RESULT_VARIABLE res)
+IF (res OR NOT out STREQUAL "")
+  MESSAGE(FATAL_ERROR "-N -a ${ARC_MODES} failed: ${res}\n${out}")
+ENDIF()
+
+FOREACH(name squeezed.seq crunched.prg squashed.usr onepass.prg)
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files
+    arc_modes/${name} arc_modes.expected)
+ENDFOREACH()
+FILE(REMOVE_RECURSE arc_modes)
+FILE(REMOVE arc_modes.expected)
@@ -29,13 +29,72 @@
 
 #include "output.h"
 
+/** Initial number of hash chains in an archive */
+#define ARCHASH 64
+
+/** Compute the hash value of a file name
+ * @param name  the Commodore file name
+ * @return      the hash value
+ */
+static unsigned
+hashName (const byte_t* name)
+{
+  unsigned h = 0, i;
+
+  for (i = 0; i < 16; i++)
+    h = h * 31 + name[i];
+
+  return h ^ h >> 16;
+}
+
+/** Double the number of hash chains in an archive
+ * when it has more entries than chains.
+ * On failure, the chains will be kept and become longer.
+ * @param archive       the archive
+ */
+static void
+growChains (struct Archive* archive)
+{
+  size_t count = archive->chainCount * 2;
+  struct ArchiveEntry** chains;
+  struct ArchiveEntry* ae;
+
+  if (archive->count < archive->chainCount ||
+      !(chains = calloc (count, sizeof *chains)))
+    return;
+
+  for (ae = archive->first; ae; ae = ae->next) {
+    ae->chain = chains[ae->hash & (count - 1)];
+    chains[ae->hash & (count - 1)] = ae;
+  }
+
+  free (archive->chains);
+  archive->chains = chains;
+  archive->chainCount = count;
+}
+
 /** Allocate an archive data structure.
- * @return      a newly allocated empty archive structure
+ * @return      a newly allocated empty archive structure,
+ *              or NULL if the temporary file could not be created
  */
 struct Archive*
 newArchive (void)
 {
-  return calloc (1, sizeof (struct Archive));
+  struct Archive* archive = calloc (1, sizeof (struct Archive));
+
+  if (!archive)
+    return 0;
+
+  archive->chainCount = ARCHASH;
+
+  if (!(archive->chains = calloc (ARCHASH, sizeof *archive->chains)) ||
+      !(archive->data = tmpfile ())) {
+    free (archive->chains);
+    free (archive);
+    return 0;
+  }
+
+  return archive;
 }
 /** Deallocate an archive data structure.
  * @param archive       the archive to be deallocated
@@ -44,11 +103,12 @@ void deleteArchive (struct Archive* archive)
 {
   while (archive->first) {
     struct ArchiveEntry* ae = archive->first->next;
-    free (archive->first->data);
     free (archive->first);
     archive->first = ae;
   }
 
+  fclose (archive->data);
+  free (archive->chains);
   free (archive);
 }
 
@@ -68,6 +128,8 @@ WriteArchive (const struct Filename* name,
               log_t log)
 {
   struct ArchiveEntry* ae;
+  unsigned hash = hashName (name->name);
+  long offset;
 
   switch (name->type) {
   case DEL:
@@ -86,8 +148,9 @@ WriteArchive (const struct Filename* name,
  valid:
   /* check for duplicate file names */
   if (!allowDuplicates)
-    for (ae = archive->first; ae; ae = ae->next)
-      if (!memcmp (&ae->name.name, name->name, sizeof name->name))
+    for (ae = archive->chains[hash & (archive->chainCount - 1)]; ae;
+         ae = ae->chain)
+      if (ae->hash == hash && !memcmp (&ae->name.name, name->name, sizeof name->name))
         return WrFileExists;
 
   if (!(ae = malloc (sizeof (*ae)))) {
@@ -95,17 +158,24 @@ WriteArchive (const struct Filename* name,
     return WrNoSpace;
   }
 
-  if (!(ae->data = malloc (length))) {
+  /* Spill the contents to the temporary file. */
+  if ((offset = ftell (archive->data)) < 0 ||
+      length != fwrite (data, 1, length, archive->data)) {
+    enum WrStatus status = errno == ENOSPC ? WrNoSpace : WrFail;
+    (*log) (Errors, name, "Temporary file: %s", strerror (errno));
+    /* Discard any partially written contents. */
+    if (offset >= 0)
+      fseek (archive->data, offset, SEEK_SET);
     free (ae);
-    (*log) (Errors, name, "Out of memory.");
-    return WrNoSpace;
+    return status;
   }
 
   memcpy (&ae->name, name, sizeof (*name));
-  if (length)
-    memcpy (ae->data, data, length);
   ae->length = length;
   ae->next = 0;
+  ae->hash = hash;
+
+  growChains (archive);
 
   if (archive->last)
     archive->last->next = ae;
@@ -113,6 +183,52 @@ WriteArchive (const struct Filename* name,
     archive->first = ae;
 
   archive->last = ae;
+  ae->chain = archive->chains[hash & (archive->chainCount - 1)];
+  archive->chains[hash & (archive->chainCount - 1)] = ae;
+  archive->count++;
 
   return WrOK;
 }
+
+/** Read the contents of the archive entries, in order.
+ * The first call after rewind (archive->data) reads the first entry.
+ * @param archive       the archive
+ * @param buf           (output) the contents, or NULL to skip them
+ * @param length        number of bytes to read
+ * @return              true if the contents were read
+ */
+bool
+readArchive (const struct Archive* archive,
+             byte_t* buf,
+             size_t length)
+{
+  if (!buf)
+    return !fseek (archive->data, (long) length, SEEK_CUR);
+  return length == fread (buf, 1, length, archive->data);
+}
+
+/** Copy the contents of the archive entries to a file, in order.
+ * @param archive       the archive
+ * @param file          the destination file
+ * @param length        number of bytes to copy
+ * @return              true if the contents were copied
+ */
+bool
+copyArchive (const struct Archive* archive,
+             FILE* file,
+             size_t length)
+{
+  byte_t buf[BUFSIZ];
+
+  while (length) {
+    size_t len = length < sizeof buf ? length : sizeof buf;
+
+    if (len != fread (buf, 1, len, archive->data) ||
+        len != fwrite (buf, 1, len, file))
+      return false;
+
+    length -= len;
+  }
+
+  return true;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file bench_image.c
+ * Micro-benchmark of disk image block lookup
+ * @author Marko Mäkelä (marko.makela at iki.fi)
+ */
+
+/*
+** Copyright © 2026 Marko Mäkelä
+**
+**     This program is free software; you can redistribute it and/or modify
+**     it under the terms of the GNU General Public License as published by
+**     the Free Software Foundation; either version 2 of the License, or
+**     (at your option) any later version.
+**
+**     This program is distributed in the hope that it will be useful,
+**     but WITHOUT ANY WARRANTY; without even the implied warranty of
+**     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**     GNU General Public License for more details.
+**
+**     You should have received a copy of the GNU General Public License
+**     along with this program; if not, write to the Free Software
+**     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <time.h>
+
+/* The functions to be measured are static. */
+#include "image.c"
+
+/** Not used by the benchmark */
+write_segments_t* writeSegments = 0;
+/** Not used by the benchmark */
+list_file_t* listFile = 0;
+/** Not used by the benchmark */
+locate_file_t* locateFile = 0;
+
+/** Get a pointer to a block by summing up the sectors of preceding tracks
+ * (the way getBlock() used to work).
+ * @param image         the disk image
+ * @param track         the track number
+ * @param sector        the sector number
+ * @return              pointer to the first byte in the sector, or NULL
+ */
+static byte_t*
+getBlockLoop (struct Image* image,
+              byte_t track,
+              byte_t sector)
+{
+  const struct DiskGeometry* geom;
+  int t, b;
+
+  if (!image || !image->buf || !(geom = getGeometry (image->type)))
+    return 0;
+
+  if (track < 1 || track > geom->tracks || sector >= geom->sectors1[track - 1])
+    return 0; /* illegal track or sector */
+
+  for (t = 1, b = 0; t < track; t++)
+    b += geom->sectors1[t - 1];
+
+  b += sector;
+
+  return &image->buf[b << 8];
+}
+
+/** Walk a chain of blocks
+ * @param image         the disk image
+ * @param get           the block lookup function
+ * @param rounds        number of times to walk the chain
+ * @param blocks        (output) number of blocks visited
+ * @return              processor time consumed, in seconds
+ */
+static double
+walk (struct Image* image,
+      byte_t* (*get) (struct Image*, byte_t, byte_t),
+      unsigned rounds,
+      size_t* blocks)
+{
+  clock_t start = clock ();
+
+  for (*blocks = 0; rounds--; ) {
+    byte_t t = 1, s = 0;
+    const byte_t* block;
+
+    while (t && (block = (*get) (image, t, s))) {
+      t = block[0];
+      s = block[1];
+      ++*blocks;
+    }
+  }
+
+  return (double) (clock () - start) / CLOCKS_PER_SEC;
+}
+
+/** The main program
+ * @param argc  number of command-line arguments
+ * @param argv  contents of the command-line arguments
+ * @return      0 on success, nonzero on error
+ */
+int
+main (int argc, char** argv)
+{
+  unsigned rounds = argc > 1 ? (unsigned) strtoul (argv[1], 0, 0) : 1000;
+  unsigned i;
+
+  for (i = 0; i < elementsof (diskGeometry); i++) {
+    const struct DiskGeometry* geom = &diskGeometry[i];
+    struct Image image;
+    byte_t t, s;
+    byte_t* prev = 0;
+    size_t loopBlocks, tableBlocks;
+    double loopTime, tableTime;
+
+    memset (&image, 0, sizeof image);
+    image.type = geom->type;
+    image.dirtrack = geom->dirtrack;
+
+    if (!(image.buf = calloc (geom->blocks, 256))) {
+      fputs ("Out of memory\n", stderr);
+      return 2;
+    }
+
+    /* Link all blocks of the image into one chain. */
+    for (t = 1; t <= geom->tracks; t++)
+      for (s = 0; s < geom->sectors1[t - 1]; s++) {
+        if (prev) {
+          prev[0] = t;
+          prev[1] = s;
+        }
+        prev = getBlockLoop (&image, t, s);
+      }
+
+    loopTime = walk (&image, getBlockLoop, rounds, &loopBlocks);
+    tableTime = walk (&image, getBlock, rounds, &tableBlocks);
+
+    if (loopBlocks != tableBlocks ||
+        loopBlocks != (size_t) rounds * geom->blocks) {
+      fprintf (stderr, "%u-block chain walk mismatch\n",
+               (unsigned) geom->blocks);
+      return 1;
+    }
+
+    printf ("%4u blocks x %u: loop %.3f s, table %.3f s (%.1f ns/block)\n",
+            (unsigned) geom->blocks, rounds, loopTime, tableTime,
+            tableBlocks ? 1e9 * tableTime / tableBlocks : 0.0);
+
+    free (image.buf);
+  }
+
+  return 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * @file bench_unarc.c
+ * Micro-benchmark of ARC/SDA Huffman decoding
+ * @author Marko Mäkelä (marko.makela at iki.fi)
+ */
+
+/*
+** Copyright © 2026 Marko Mäkelä
+**
+**     This program is free software; you can redistribute it and/or modify
+**     it under the terms of the GNU General Public License as published by
+**     the Free Software Foundation; either version 2 of the License, or
+**     (at your option) any later version.
+**
+**     This program is distributed in the hope that it will be useful,
+**     but WITHOUT ANY WARRANTY; without even the implied warranty of
+**     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**     GNU General Public License for more details.
+**
+**     You should have received a copy of the GNU General Public License
+**     along with this program; if not, write to the Free Software
+**     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <time.h>
+
+/* The functions to be measured are static. */
+#include "unarc.c"
+
+/** Not used by the benchmark */
+list_file_t* listFile = 0;
+/** Not used by the benchmark */
+locate_file_t* locateFile = 0;
+
+/** Length of the synthetic squeezed file */
+#define LENGTH 65536
+
+/** Fetch a Huffman code by searching the sorted code table
+ * (the way Huffin() used to work).
+ * @param arc   the decoder state
+ * @return      the converted code
+ */
+static byte_t
+HuffinScan (struct Arc* arc)
+{
+  unsigned long hcode;
+  unsigned long mask  = 1;
+  int  size  = 1;
+  int  now;
+
+  now = arc->hcount;       /* First non-zero Huffman code */
+
+  FillBits (arc, HUFFMAX);
+  hcode = arc->BitBuf;
+
+  do {
+    while( arc->hl[now] == size) {
+
+      if (arc->hc[now] == (hcode & mask)) {
+        DropBits (arc, size);
+        return arc->hv[now];
+      }
+
+      if (--now < 0) {         /* Error in decode table */
+        DropBits (arc, size);
+        arc->Status = EOF;
+        return 0;
+      }
+    }
+    size++;
+    mask = (mask << 1) | 1;
+  } while (size < 24);
+
+  DropBits (arc, 23);
+  arc->Status = EOF;                /* Error. Huffman code too big */
+  return 0;
+}
+
+/** Append bits to a buffer, least significant bit first
+ * @param buf   the buffer
+ * @param pos   (input/output) number of bits in the buffer
+ * @param bits  the bits to be appended
+ * @param count number of bits to append
+ */
+static void
+putBits (byte_t* buf, size_t* pos, unsigned long bits, unsigned count)
+{
+  for (; count--; ++*pos, bits >>= 1)
+    if (bits & 1)
+      buf[*pos >> 3] |= (byte_t) (1 << (*pos & 7));
+}
+
+/** Compute Huffman code lengths
+ * @param freq          the symbol frequencies
+ * @param length        (output) the code lengths
+ */
+static void
+huffman (const unsigned long* freq, unsigned* length)
+{
+  unsigned long weight[511];
+  int parent[511];
+  unsigned n, nodes;
+
+  for (n = 0; n < 256; n++)
+    weight[n] = freq[n] + 1, parent[n] = -1;
+
+  /* Merge the two lightest nodes until one remains. */
+  for (nodes = 256; nodes < 511; nodes++) {
+    int min[2] = { -1, -1 };
+    unsigned i;
+
+    for (i = 0; i < nodes; i++) {
+      if (parent[i] >= 0)
+        continue;
+      if (min[0] < 0 || weight[i] < weight[min[0]])
+        min[1] = min[0], min[0] = (int) i;
+      else if (min[1] < 0 || weight[i] < weight[min[1]])
+        min[1] = (int) i;
+    }
+
+    weight[nodes] = weight[min[0]] + weight[min[1]];
+    parent[nodes] = -1;
+    parent[min[0]] = parent[min[1]] = (int) nodes;
+  }
+
+  for (n = 0; n < 256; n++) {
+    int i;
+    for (length[n] = 0, i = parent[n]; i >= 0; i = parent[i])
+      length[n]++;
+  }
+}
+
+/** Create a squeezed ARC64 archive
+ * @param data          the contents of the archived file
+ * @param size          (output) length of the archive
+ * @return              the archive, or NULL if out of memory
+ */
+static byte_t*
+squeeze (const byte_t* data, size_t* size)
+{
+  static const byte_t header[] = {
+    2, 2, 0, 0, LENGTH & 0xff, (LENGTH >> 8) & 0xff, LENGTH >> 16,
+    0, 0, 'P', 1, 'B', 0, 0, 0
+  };
+  unsigned long freq[256], code[256];
+  unsigned length[256];
+  unsigned long c = 0;
+  unsigned n, l;
+  size_t pos = 0, i;
+  byte_t* buf;
+
+  memset (freq, 0, sizeof freq);
+  for (i = 0; i < LENGTH; i++)
+    freq[data[i]]++;
+
+  huffman (freq, length);
+
+  /* Assign canonical codes, transmitted most significant bit first. */
+  for (l = 1; l <= HUFFMAX; l++, c <<= 1) {
+    for (n = 0; n < 256; n++) {
+      unsigned long r = 0;
+      unsigned j;
+      if (length[n] != l)
+        continue;
+      for (j = 0; j < l; j++)
+        r |= ((c >> j) & 1) << (l - 1 - j);
+      code[n] = r;
+      c++;
+    }
+  }
+
+  for (n = 0; n < 256; n++)
+    if (length[n] > HUFFMAX)
+      return 0;
+
+  if (!(buf = calloc (sizeof header + 256 * (5 + HUFFMAX) / 8 +
+                      LENGTH * HUFFMAX / 8 + 2, 1)))
+    return 0;
+
+  memcpy (buf, header, sizeof header);
+  pos = 8 * sizeof header;
+
+  for (n = 0; n < 256; n++) {
+    putBits (buf, &pos, length[n], 5);
+    putBits (buf, &pos, code[n], length[n]);
+  }
+
+  for (i = 0; i < LENGTH; i++)
+    putBits (buf, &pos, code[data[i]], length[data[i]]);
+
+  *size = (pos + 7) / 8;
+  return buf;
+}
+
+/** Decode the squeezed file
+ * @param arc           the decoder state
+ * @param huffin        the Huffman decoding function
+ * @param rounds        number of times to decode the file
+ * @param out           (output) the decoded file
+ * @return              processor time consumed, in seconds
+ */
+static double
+decode (struct Arc* arc,
+        byte_t (*huffin) (struct Arc*),
+        unsigned rounds,
+        byte_t* out)
+{
+  clock_t start = clock ();
+
+  while (rounds--) {
+    size_t i;
+
+    SeekArc (arc, 0);
+    if (!GetHeader (arc))
+      return -1;
+
+    for (i = 0; i < LENGTH; i++)
+      out[i] = (*huffin) (arc);
+  }
+
+  return (double) (clock () - start) / CLOCKS_PER_SEC;
+}
+
+/** The main program
+ * @param argc  number of command-line arguments
+ * @param argv  contents of the command-line arguments
+ * @return      0 on success, nonzero on error
+ */
+int
+main (int argc, char** argv)
+{
+  unsigned rounds = argc > 1 ? (unsigned) strtoul (argv[1], 0, 0) : 100;
+  static byte_t data[LENGTH], scanned[LENGTH], looked[LENGTH];
+  unsigned long seed = 1;
+  double scanTime, tableTime;
+  struct Arc* arc;
+  size_t i;
+
+  /* Generate text-like data with a skewed symbol distribution. */
+  for (i = 0; i < LENGTH; i++) {
+    unsigned r;
+    seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+    r = (unsigned) (seed >> 16) & 0x7fff;
+    data[i] = (byte_t) (r * r / 0x40000 * r / 0x8000);
+  }
+
+  if (!(arc = calloc (1, sizeof *arc)) ||
+      !(arc->data = squeeze (data, &arc->size))) {
+    fputs ("Out of memory\n", stderr);
+    return 2;
+  }
+
+  scanTime = decode (arc, HuffinScan, rounds, scanned);
+  tableTime = decode (arc, Huffin, rounds, looked);
+
+  if (scanTime < 0 || tableTime < 0 || arc->Status == EOF ||
+      memcmp (data, scanned, LENGTH) || memcmp (data, looked, LENGTH)) {
+    fputs ("squeezed data mismatch\n", stderr);
+    return 1;
+  }
+
+  printf ("%u bytes x %u: scan %.3f s, table %.3f s (%.1f ns/byte)\n",
+          LENGTH, rounds, scanTime, tableTime,
+          1e9 * tableTime / ((double) LENGTH * rounds));
+
+  free (arc->data);
+  free (arc);
+  return 0;
+}
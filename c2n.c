@@ -98,50 +98,75 @@ name2header (const struct Filename* name,
 
 /** Read and convert a Commodore C2N tape archive
  * @param file          the file input stream
- * @param filename      host system name of the file
  * @param writeCallback function for writing the contained files
  * @param log           Call-back function for diagnostic output
+ * @param arena         memory arena for the file contents
  * @return              status of the operation
  */
-enum RdStatus
-ReadC2N (FILE* file,
-         const char* filename,
+static enum RdStatus
+readC2N (FILE* file,
          write_file_t writeCallback,
-         log_t log)
+         log_t log,
+         struct Arena* arena)
 {
   /** name of the file being processed */
   struct Filename name;
-
-  (void) filename; /* unused */
+  /** contents of the tape archive */
+  byte_t* data;
+  /** length of the tape archive in bytes */
+  size_t size;
+  /** offset of the next unprocessed byte */
+  size_t pos;
 
   /* clear the file type code (to denote uninitialized file name) */
   name.type = NUL;
   /* clear the record length (no relative files on tapes) */
   name.recordLength = 0;
 
-  while (!feof (file)) {
+  /* Read the whole archive to memory. */
+  {
+    long length;
+
+    if (fseek (file, 0, SEEK_END) || (length = ftell (file)) < 0 ||
+        fseek (file, 0, SEEK_SET)) {
+      (*log) (Errors, 0, "fseek: %s", strerror (errno));
+      return RdFail;
+    }
+
+    size = (size_t) length;
+
+    if (!(data = arenaAlloc (arena, size ? size : 1))) {
+      (*log) (Errors, 0, "Out of memory.");
+      return RdFail;
+    }
+
+    if (size != fread (data, 1, size, file)) {
+      (*log) (Errors, 0, "fread: %s", strerror (errno));
+      return RdFail;
+    }
+  }
+
+  for (pos = 0; pos < size; ) {
     /** tape header */
     struct c2n_header header;
     /** start address of the file being processed */
     unsigned start;
     /** end address of the file being processed */
     unsigned end;
+    /** the file contents */
+    byte_t* buf;
+    /** length of the file contents */
+    size_t length;
 
-    switch (fread (&header, 1, sizeof header, file)) {
-    case 0:
-      if (!ferror (file))
-        continue;
-      (*log) (Errors, name.type ? &name : 0, "fread: %s", strerror (errno));
-      return RdFail;
-    case 192:
-      break;
-    default:
+    if (size - pos < sizeof header) {
     errEOF:
       (*log) (Errors, name.type ? &name : 0, "unexpected end of file");
       return RdFail;
     }
 
-  nextHeader:
+    memcpy (&header, data + pos, sizeof header);
+    pos += sizeof header;
+
     start = header.startAddrLow | (unsigned) header.startAddrHigh << 8;
     end = header.endAddrLow | (unsigned) header.endAddrHigh << 8;
 
@@ -178,102 +203,78 @@ ReadC2N (FILE* file,
     }
 
     if (name.type == SEQ) {
-      /** number of bytes read so far */
-      size_t length = 0;
-      /** the data buffer */
-      byte_t* buf = 0;
-
-    nextBlock:
-      switch (fread (&header, 1, sizeof header, file)) {
-      case 0:
-        if (!ferror (file))
-          goto writeData;
-        (*log) (Errors, &name, "fread: %s", strerror (errno));
-      errExit:
-        free (buf);
-        return RdFail;
-      case 192:
-        break;
-      default:
-        free (buf);
-        goto errEOF;
-      }
+      /* Assemble the data file in place, by moving the contents of
+         each data block over the tags of the preceding blocks. */
+      buf = data + pos;
 
-      if (header.tag == tDataBlock) {
-        byte_t* b = realloc (buf, length + (sizeof header) - 1);
-        if (!b) {
-          (*log) (Errors, &name, "Out of memory.");
-          goto errExit;
-        }
-        buf = b;
-        memcpy (buf + length, ((byte_t*) &header) + 1, (sizeof header) - 1);
+      for (length = 0; size - pos >= sizeof header &&
+             data[pos] == tDataBlock; pos += sizeof header) {
+        if (!listFile)
+          memmove (buf + length, data + pos + 1, (sizeof header) - 1);
         length += (sizeof header) - 1;
-        goto nextBlock;
       }
-      else {
-        enum WrStatus status;
-      writeData:
-        if (!length)
-          (*log) (Warnings, &name, "no data");
-        status = (*writeCallback) (&name, buf, length);
-        free (buf);
-        switch (status) {
-        case WrOK:
-          if (feof (file))
-            return RdOK;
-          goto nextHeader;
-        case WrNoSpace:
-          return RdNoSpace;
-        case WrFail:
-        case WrFileExists:
-          break;
-        }
 
-        return RdFail;
-      }
+      if (pos < size && size - pos < sizeof header)
+        goto errEOF;
+
+      if (!length)
+        (*log) (Warnings, &name, "no data");
     }
     else {
-      byte_t* buf;
-      enum WrStatus status;
-      size_t readlength, length = (end - start) & 0xffff;
+      length = (end - start) & 0xffff;
 
-      if (!(buf = malloc (length + 2))) {
-        (*log) (Errors, &name, "Out of memory.");
-        return RdFail;
+      if (length > size - pos) {
+        (*log) (Warnings, &name, "Truncated file, proceeding anyway");
+        length = size - pos;
       }
 
+      /* Store the start address in the last bytes of the header. */
+      buf = data + pos - 2;
       buf[0] = header.startAddrLow;
       buf[1] = header.startAddrHigh;
+      pos += length;
+      length += 2;
+    }
 
-      if (length != (readlength = fread (&buf[2], 1, length, file))) {
-        if (feof (file))
-          (*log) (Warnings, &name, "Truncated file, proceeding anyway");
-        if (ferror (file)) {
-          (*log) (Errors, &name, "fread: %s", strerror (errno));
-          free (buf);
-          return RdFail;
-        }
-      }
-
-      status = (*writeCallback) (&name, buf, readlength + 2);
-      free (buf);
-
-      switch (status) {
-      case WrOK:
-        continue;
-      case WrNoSpace:
-        return RdNoSpace;
-      case WrFail:
-      case WrFileExists:
-        break;
-      }
-      return RdFail;
+    switch (listFile
+            ? (*listFile) (&name, length)
+            : (*writeCallback) (&name, buf, length)) {
+    case WrOK:
+      continue;
+    case WrNoSpace:
+      return RdNoSpace;
+    case WrFail:
+    case WrFileExists:
+      break;
     }
+    return RdFail;
   }
 
   return RdOK;
 }
 
+/** Read and convert a Commodore C2N tape archive
+ * @param file          the file input stream
+ * @param filename      host system name of the file
+ * @param writeCallback function for writing the contained files
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+enum RdStatus
+ReadC2N (FILE* file,
+         const char* filename,
+         write_file_t writeCallback,
+         log_t log)
+{
+  struct Arena arena = { 0 };
+  enum RdStatus status = readC2N (file, writeCallback, log, &arena);
+
+  (void) filename; /* unused */
+
+  arenaRelease (&arena);
+  return status;
+}
+
 /** Write an archive in Commodore C2N tape format
  * @param archive       the archive to be written
  * @param filename      host file name of the archive file
@@ -289,6 +290,8 @@ ArchiveC2N (const struct Archive* archive,
   if (!(f = fopen (filename, "wb")))
     return errno == ENOSPC ? ArNoSpace : ArFail;
 
+  rewind (archive->data);
+
   for (ae = archive->first; ae; ae = ae->next) {
     /** tape header */
     struct c2n_header header;
@@ -296,18 +299,22 @@ ArchiveC2N (const struct Archive* archive,
 
     if (ae->name.type == PRG) {
       size_t end = ae->length;
-      if (end < 2)
-        continue; /* too short file */
+      if (end < 2) {
+        /* too short file */
+        if (!readArchive (archive, 0, end))
+          goto fail;
+        continue;
+      }
 
-      header.startAddrLow = ae->data[0];
-      header.startAddrHigh = ae->data[1];
+      if (!readArchive (archive, &header.startAddrLow, 2))
+        goto fail;
       end += header.startAddrLow | (unsigned) header.startAddrHigh << 8;
       header.endAddrLow = (byte_t) (end -= 2);
       header.endAddrHigh = (byte_t) (end >> 8);
       header.tag = header.startAddrLow == 1 ? tBasic : tML;
 
       if (1 != fwrite (&header, sizeof header, 1, f) ||
-          ae->length - 2 != fwrite (ae->data + 2, 1, ae->length - 2, f)) {
+          !copyArchive (archive, f, ae->length - 2)) {
       fail:
         fclose (f);
         return ArFail;
@@ -326,11 +333,13 @@ ArchiveC2N (const struct Archive* archive,
         unsigned next = cnt + (sizeof header) - 1;
         header.tag = tDataBlock;
         if (next > ae->length) {
-          memcpy (&header.startAddrLow, ae->data + cnt, ae->length - cnt);
+          if (!readArchive (archive, &header.startAddrLow, ae->length - cnt))
+            goto fail;
           (&header.startAddrLow)[ae->length - cnt] = 0;
         }
-        else
-          memcpy (&header.startAddrLow, ae->data + cnt, (sizeof header) - 1);
+        else if (!readArchive (archive, &header.startAddrLow,
+                               (sizeof header) - 1))
+          goto fail;
         if (1 != fwrite (&header, sizeof header, 1, f))
           goto fail;
         cnt = next;
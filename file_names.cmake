@@ -52,13 +52,11 @@ FILE(WRITE f.c2n "${t21}JUNK            ${s64}${s64}${s64}")
 FOREACH(i RANGE 1 10)
   CBMCONVERT(-c f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n)
 ENDFOREACH()
-IF (FALSE) # This is very slow
-  FOREACH(i RANGE 11 1000)
-    CBMCONVERT(-c f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n)
-  ENDFOREACH()
-  CBMCONVERT(-c f.c2n)
-  EXECUTE_PROGRAM_EXPECT(4 ${CBMCONVERT} -c f.c2n)
-ENDIF()
+FOREACH(i RANGE 11 1000)
+  CBMCONVERT(-c f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n f.c2n)
+ENDFOREACH()
+CBMCONVERT(-c f.c2n)
+EXECUTE_PROGRAM_EXPECT(4 ${CBMCONVERT} -c f.c2n)
 
 FILE(GLOB junk junk~*.prg)
 FILE(REMOVE f.c2n junk.prg ${junk})
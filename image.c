@@ -29,6 +29,12 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "output.h"
 #include "input.h"
@@ -50,6 +56,8 @@ struct DiskGeometry
   byte_t tracks;
   /** number of sectors per track */
   const byte_t* sectors1;
+  /** number of the first block of each track */
+  const word_t* offset1;
   /** sector interleaves (number of sectors to advance) */
   const byte_t* interleave1;
 };
@@ -169,6 +177,44 @@ static const byte_t sect1581[] =
   40, 40, 40, 40, 40, 40, 40, 40, 40, 40
 };
 
+/** table of the first block number of each track on the 1541 */
+static const word_t off1541[] =
+{
+    0,  21,  42,  63,  84, 105, 126, 147, 168, /* tracks  1 .. 9  */
+  189, 210, 231, 252, 273, 294, 315, 336,      /* tracks 10 .. 17 */
+  357, 376, 395, 414, 433, 452, 471,           /* tracks 18 .. 24 */
+  490, 508, 526, 544, 562, 580,                /* tracks 25 .. 30 */
+  598, 615, 632, 649, 666                      /* tracks 31 .. 35 */
+};
+
+/** table of the first block number of each track on the 1571 */
+static const word_t off1571[] =
+{
+     0,   21,   42,   63,   84,  105,  126,  147,  168, /* tracks  1 .. 9  */
+   189,  210,  231,  252,  273,  294,  315,  336,       /* tracks 10 .. 17 */
+   357,  376,  395,  414,  433,  452,  471,             /* tracks 18 .. 24 */
+   490,  508,  526,  544,  562,  580,                   /* tracks 25 .. 30 */
+   598,  615,  632,  649,  666,                         /* tracks 31 .. 35 */
+   683,  704,  725,  746,  767,  788,  809,  830,  851, /* tracks 36 .. 44 */
+   872,  893,  914,  935,  956,  977,  998, 1019,       /* tracks 45 .. 52 */
+  1040, 1059, 1078, 1097, 1116, 1135, 1154,             /* tracks 53 .. 59 */
+  1173, 1191, 1209, 1227, 1245, 1263,                   /* tracks 60 .. 65 */
+  1281, 1298, 1315, 1332, 1349                          /* tracks 66 .. 70 */
+};
+
+/** table of the first block number of each track on the 1581 */
+static const word_t off1581[] =
+{
+     0,   40,   80,  120,  160,  200,  240,  280,  320,  360,
+   400,  440,  480,  520,  560,  600,  640,  680,  720,  760,
+   800,  840,  880,  920,  960, 1000, 1040, 1080, 1120, 1160,
+  1200, 1240, 1280, 1320, 1360, 1400, 1440, 1480, 1520, 1560,
+  1600, 1640, 1680, 1720, 1760, 1800, 1840, 1880, 1920, 1960,
+  2000, 2040, 2080, 2120, 2160, 2200, 2240, 2280, 2320, 2360,
+  2400, 2440, 2480, 2520, 2560, 2600, 2640, 2680, 2720, 2760,
+  2800, 2840, 2880, 2920, 2960, 3000, 3040, 3080, 3120, 3160
+};
+
 /** table of interleave per track on the 1541 */
 static const byte_t int1541[] = {
   10, 10, 10, 10, 10, 10, 10, 10, 10, /* tracks  1 .. 9  */
@@ -218,6 +264,7 @@ static const struct DiskGeometry diskGeometry[] =
     18,
     elementsof(sect1541),
     sect1541,
+    off1541,
     int1541
   },
   {
@@ -228,6 +275,7 @@ static const struct DiskGeometry diskGeometry[] =
     18,
     elementsof(sect1571),
     sect1571,
+    off1571,
     int1571
   },
   {
@@ -238,6 +286,7 @@ static const struct DiskGeometry diskGeometry[] =
     40,
     elementsof(sect1581),
     sect1581,
+    off1581,
     int1581
   },
 };
@@ -270,7 +319,6 @@ getBlock (struct Image* image,
           byte_t sector)
 {
   const struct DiskGeometry* geom;
-  int t, b;
 
   if (!image || !image->buf || !(geom = getGeometry (image->type)))
     return 0;
@@ -278,22 +326,101 @@ getBlock (struct Image* image,
   if (track < 1 || track > geom->tracks || sector >= geom->sectors1[track - 1])
     return 0; /* illegal track or sector */
 
-  for (t = 1, b = 0; t < track; t++)
-    b += geom->sectors1[t - 1];
+  return &image->buf[(size_t) (geom->offset1[track - 1] + sector) << 8];
+}
+
+/** Load a disk image file to memory.
+ * @param image         the disk image (buf and mapped will be set)
+ * @param file          the disk image file, positioned at its start
+ * @param length        length of the file in bytes
+ * @param log           Call-back function for diagnostic output (optional)
+ * @return              true if the image was loaded
+ */
+static bool
+loadImage (struct Image* image, FILE* file, size_t length, log_t log)
+{
+#ifdef HAVE_MMAP
+  /* A private mapping, so that changes only reach the file when
+     CloseImage() writes the modified blocks. */
+  void* buf = mmap (0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fileno (file), 0);
+
+  if (buf != MAP_FAILED) {
+    image->buf = buf;
+    image->mapped = true;
+    return true;
+  }
+#endif
+
+  /* Fall back to reading the file into a buffer. */
+  image->mapped = false;
+
+  if (!(image->buf = malloc (length))) {
+    if (log)
+      (*log) (Errors, 0, "Out of memory");
+    return false;
+  }
+
+  if (1 != fread (image->buf, length, 1, file)) {
+    if (log)
+      (*log) (Errors, 0, "fread: %s", strerror(errno));
+    free (image->buf);
+    image->buf = 0;
+    return false;
+  }
 
-  b += sector;
+  return true;
+}
 
-  return &image->buf[b << 8];
+/** Release the memory of a disk image that was loaded by loadImage().
+ * @param image         the disk image
+ */
+static void
+unloadImage (struct Image* image)
+{
+#ifdef HAVE_MMAP
+  if (image->mapped)
+    munmap (image->buf, getGeometry (image->type)->blocks * 256);
+  else
+#endif
+    free (image->buf);
+
+  image->buf = 0;
+  image->mapped = false;
+  arenaRelease (&image->arena);
 }
 
-/** Determine if the block at the specified track and sector is free.
+/** Mark a block of a disk image modified.
+ * @param image         the disk image
+ * @param block         pointer to the block, or to any byte in it
+ */
+static void
+markDirty (struct Image* image, const void* block)
+{
+  size_t b = (size_t) ((const byte_t*) block - image->buf) >> 8;
+  image->dirtyMap[b / MAPBITS] |= 1UL << (b % MAPBITS);
+}
+
+/** Determine whether a block of a disk image has been modified.
+ * @param image         the disk image
+ * @param b             the block number
+ * @return              true if the block has been modified
+ */
+static bool
+isDirty (const struct Image* image, size_t b)
+{
+  return !!(image->dirtyMap[b / MAPBITS] & (1UL << (b % MAPBITS)));
+}
+
+/** Determine if the Block Availability Map of the disk image
+ * marks the block at the specified track and sector free.
  * @param image         the disk image
  * @param track         the track number
  * @param sector        the sector number
  * @return              true if the block is available
  */
 static bool
-isFreeBlock (const struct Image* image, byte_t track, byte_t sector)
+isFreeBAM (const struct Image* image, byte_t track, byte_t sector)
 {
   const struct DiskGeometry* geom;
 
@@ -346,6 +473,164 @@ isFreeBlock (const struct Image* image, byte_t track, byte_t sector)
   return false;
 }
 
+/** Initialize the free block bitmap from the Block Availability Map.
+ * This must be invoked whenever the BAM has been modified by other
+ * means than allocBlock() or freeBlock().
+ * @param image         the disk image
+ */
+static void
+readFreeMap (struct Image* image)
+{
+  const struct DiskGeometry* geom;
+  byte_t track, sector;
+
+  memset (image->freeMap, 0, sizeof image->freeMap);
+
+  if (!image->buf || !(geom = getGeometry (image->type)))
+    return;
+
+  for (track = 1; track <= geom->tracks; track++)
+    for (sector = 0; sector < geom->sectors1[track - 1]; sector++)
+      if (isFreeBAM (image, track, sector)) {
+        unsigned b = geom->offset1[track - 1] + sector;
+        image->freeMap[b / MAPBITS] |= 1UL << (b % MAPBITS);
+      }
+}
+
+/** Update the free block bitmap.
+ * @param image         the disk image
+ * @param geom          the disk geometry
+ * @param track         the track number
+ * @param sector        the sector number
+ * @param isFree        whether the block is available
+ */
+static void
+setFreeMap (struct Image* image, const struct DiskGeometry* geom,
+            byte_t track, byte_t sector, bool isFree)
+{
+  unsigned b = geom->offset1[track - 1] + sector;
+
+  if (isFree)
+    image->freeMap[b / MAPBITS] |= 1UL << (b % MAPBITS);
+  else
+    image->freeMap[b / MAPBITS] &= ~(1UL << (b % MAPBITS));
+}
+
+/** Determine if the block at the specified track and sector is free.
+ * @param image         the disk image
+ * @param track         the track number
+ * @param sector        the sector number
+ * @return              true if the block is available
+ */
+static bool
+isFreeBlock (const struct Image* image, byte_t track, byte_t sector)
+{
+  const struct DiskGeometry* geom;
+  unsigned b;
+
+  if (!image || !image->buf || !(geom = getGeometry (image->type)))
+    return false;
+
+  if (track < 1 || track > geom->tracks || sector >= geom->sectors1[track - 1])
+    return false; /* illegal track or sector */
+
+  b = geom->offset1[track - 1] + sector;
+  return !!(image->freeMap[b / MAPBITS] & (1UL << (b % MAPBITS)));
+}
+
+/** Find the first free block in a range of block numbers.
+ * @param image         the disk image
+ * @param from          the first block number to consider
+ * @param to            the block number after the last one to consider
+ * @return              the first free block number, or to if none found
+ */
+static unsigned
+findFreeBit (const struct Image* image, unsigned from, unsigned to)
+{
+  while (from < to) {
+    unsigned long w = image->freeMap[from / MAPBITS] >> (from % MAPBITS);
+
+    if (w) {
+#if defined __GNUC__
+      from += (unsigned) __builtin_ctzl (w);
+#elif defined _MSC_VER
+      unsigned long bit;
+      _BitScanForward (&bit, w);
+      from += bit;
+#else
+      for (; !(w & 1); w >>= 1)
+        from++;
+#endif
+      return from < to ? from : to;
+    }
+
+    from += MAPBITS - from % MAPBITS;
+  }
+
+  return to;
+}
+
+/** Find a free block on a track, visiting the sectors in interleave order.
+ * @param image         the disk image
+ * @param geom          the disk geometry
+ * @param t             the track number
+ * @param s             (input/output) the sector number to start from;
+ *                      if none found, the sector to start from on the
+ *                      next track to be searched
+ * @return              true if a free block was found
+ */
+static bool
+findFreeOnTrack (const struct Image* image,
+                 const struct DiskGeometry* geom,
+                 byte_t t,
+                 byte_t* s)
+{
+  const unsigned first = geom->offset1[t - 1];
+  const byte_t sectors = geom->sectors1[t - 1];
+  size_t visited[64 / (sizeof(size_t) * CHAR_BIT)];
+  unsigned i, b;
+  bool any;
+
+  if (geom->interleave1[t - 1] == 1 && *s < sectors) {
+    /* The sectors are visited in the order *s..sectors-1, 0..*s-1.
+       If none of them is free, the search will continue from sector 0. */
+    if ((b = findFreeBit (image, first + *s, first + sectors)) ==
+        first + sectors &&
+        (b = findFreeBit (image, first, first + *s)) == first + *s) {
+      *s = 0;
+      return false;
+    }
+
+    *s = (byte_t) (b - first);
+    return true;
+  }
+
+  any = findFreeBit (image, first, first + sectors) < first + sectors;
+  memset(visited, 0, sizeof visited);
+
+  for (i = sectors; i; i--) {
+    if (any && *s < sectors &&
+        image->freeMap[(first + *s) / MAPBITS] &
+        (1UL << ((first + *s) % MAPBITS)))
+      return true;
+    visited[*s / ((sizeof *visited) * CHAR_BIT)] |=
+      ((size_t) 1) << (*s % ((sizeof *visited) * CHAR_BIT));
+    *s += geom->interleave1[t - 1];
+    *s %= sectors;
+
+    while (visited[*s / ((sizeof *visited) * CHAR_BIT)] &
+           ((size_t) 1) << (*s % ((sizeof *visited) * CHAR_BIT)))
+      if (++*s == sectors) {
+        *s = 0;
+        if (i == 1)
+          break;
+        i--;
+      }
+  }
+
+  return false;
+}
+
 /** Find the next free block that is closest to the specified track and sector.
  * @param image         the disk image
  * @param track         (input/output) the track number
@@ -359,8 +644,6 @@ findNextFree (const struct Image* image,
 {
   const struct DiskGeometry* geom;
   byte_t t = *track, s = *sector;
-  size_t visited[64 / (sizeof(size_t) * CHAR_BIT)];
-  unsigned i;
 
   if (!image || !image->buf || !(geom = getGeometry (image->type)))
     return false;
@@ -371,134 +654,43 @@ findNextFree (const struct Image* image,
   if (t >= image->dirtrack) {
     /* search from the current track upwards */
 
-    for (; t <= image->partTops[image->dirtrack - 1]; t++) {
-      memset(visited, 0, sizeof visited);
-      for (i = geom->sectors1[t - 1]; i; i--) {
-        if (isFreeBlock (image, t, s)) {
-          *track = t;
-          *sector = s;
-          return true;
-        }
-        visited[s / ((sizeof *visited) * CHAR_BIT)] |=
-          ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT));
-        s += geom->interleave1[t - 1];
-        s %= geom->sectors1[t - 1];
-
-        while (visited[s / ((sizeof *visited) * CHAR_BIT)] &
-               ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT)))
-          if (++s == geom->sectors1[t - 1]) {
-            s = 0;
-            if (i == 1)
-              break;
-            i--;
-          }
-      }
-    }
+    for (; t <= image->partTops[image->dirtrack - 1]; t++)
+      if (findFreeOnTrack (image, geom, t, &s))
+        goto found;
 
     /* search from lower tracks (from the directory track downwards) */
 
     for (t = image->dirtrack - 1;
-         t >= image->partBots[image->dirtrack - 1]; t--) {
-      memset(visited, 0, sizeof visited);
-      for (i = geom->sectors1[t - 1]; i; i--) {
-        if (isFreeBlock (image, t, s)) {
-          *track = t;
-          *sector = s;
-          return true;
-        }
-        visited[s / ((sizeof *visited) * CHAR_BIT)] |=
-          ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT));
-        s += geom->interleave1[t - 1];
-        s %= geom->sectors1[t - 1];
-        while (visited[s / ((sizeof *visited) * CHAR_BIT)] &
-               ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT)))
-          if (++s == geom->sectors1[t - 1]) {
-            s = 0;
-            if (i == 1)
-              break;
-            i--;
-          }
-      }
-    }
+         t >= image->partBots[image->dirtrack - 1]; t--)
+      if (findFreeOnTrack (image, geom, t, &s))
+        goto found;
   }
   else {
     /* search from the current track downwards */
 
-    for (; t >= image->partBots[image->dirtrack - 1]; t--) {
-      memset(visited, 0, sizeof visited);
-      for (i = geom->sectors1[t - 1]; i; i--) {
-        if (isFreeBlock (image, t, s)) {
-          *track = t;
-          *sector = s;
-          return true;
-        }
-        visited[s / ((sizeof *visited) * CHAR_BIT)] |=
-          ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT));
-        s += geom->interleave1[t - 1];
-        s %= geom->sectors1[t - 1];
-        while (visited[s / ((sizeof *visited) * CHAR_BIT)] &
-               ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT)))
-          if (++s == geom->sectors1[t - 1]) {
-            s = 0;
-            if (i == 1)
-              break;
-            i--;
-          }
-      }
-    }
+    for (; t >= image->partBots[image->dirtrack - 1]; t--)
+      if (findFreeOnTrack (image, geom, t, &s))
+        goto found;
 
     /* search from upper tracks (from the directory track upwards) */
 
     for (t = image->dirtrack + 1;
-         t <= image->partTops[image->dirtrack - 1]; t++) {
-      memset(visited, 0, sizeof visited);
-      for (i = geom->sectors1[t - 1]; i; i--) {
-        if (isFreeBlock (image, t, s)) {
-          *track = t;
-          *sector = s;
-          return true;
-        }
-        visited[s / ((sizeof *visited) * CHAR_BIT)] |=
-          ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT));
-        s += geom->interleave1[t - 1];
-        s %= geom->sectors1[t - 1];
-        while (visited[s / ((sizeof *visited) * CHAR_BIT)] &
-               ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT)))
-          if (++s == geom->sectors1[t - 1]) {
-            s = 0;
-            if (i == 1)
-              break;
-            i--;
-          }
-      }
-    }
+         t <= image->partTops[image->dirtrack - 1]; t++)
+      if (findFreeOnTrack (image, geom, t, &s))
+        goto found;
 
     /* last resort: search from the directory track */
     t = image->dirtrack;
-    memset(visited, 0, sizeof visited);
 
-    for (i = geom->sectors1[t - 1]; i; i--) {
-      if (isFreeBlock (image, t, s)) {
-        *track = t;
-        *sector = s;
-        return true;
-      }
-      visited[s / ((sizeof *visited) * CHAR_BIT)] |=
-        ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT));
-      s += geom->interleave1[t - 1];
-      s %= geom->sectors1[t - 1];
-      while (visited[s / ((sizeof *visited) * CHAR_BIT)] &
-             ((size_t) 1) << (s % ((sizeof *visited) * CHAR_BIT)))
-        if (++s == geom->sectors1[t - 1]) {
-          s = 0;
-          if (i == 1)
-            break;
-          i--;
-        }
-    }
+    if (findFreeOnTrack (image, geom, t, &s))
+      goto found;
   }
 
   return false;
+found:
+  *track = t;
+  *sector = s;
+  return true;
 }
 
 /** Get a block pointer table to all blocks in the file
@@ -554,12 +746,12 @@ mapInode (byte_t*** buf, struct Image* image, byte_t track, byte_t sector,
 
   /* Set up the block pointer table. */
 
-  if (!(*buf = malloc (size * sizeof **buf)))
+  if (!(*buf = arenaAlloc (&image->arena, size * sizeof **buf)))
     return 0;
 
   for (t = track, s = sector, size = 0; t; size++) {
     if (!((*buf)[size] = getBlock (image, t, s))) {
-      free (*buf);
+      arenaFree (&image->arena, *buf);
       *buf = 0;
       return 0;
     }
@@ -614,6 +806,9 @@ allocBlock (struct Image* image,
       BAM[0xDC + tr]--;
       /* allocate the block */
       BAM2[((tr - 1) * 3) + (*sector >> 3)] &= (byte_t) ~(1 << (*sector & 7));
+      markDirty (image, BAM);
+      markDirty (image, BAM2);
+      setFreeMap (image, geom, *track, *sector, false);
 
       /* find next free block */
       findNextFree (image, track, sector);
@@ -631,6 +826,8 @@ allocBlock (struct Image* image,
     BAM[*track << 2]--;
     /* allocate the block */
     BAM[(*track << 2) + 1 + (*sector >> 3)] &= (byte_t) ~(1 << (*sector & 7));
+    markDirty (image, BAM);
+    setFreeMap (image, geom, *track, *sector, false);
 
     /* find next free block */
     findNextFree (image, track, sector);
@@ -657,7 +854,7 @@ allocBlock (struct Image* image,
       else
         BAM = BAMblocks[0];
 
-      free (BAMblocks);
+      arenaFree (&image->arena, BAMblocks);
 
       if (2 != s)
         return false;
@@ -669,6 +866,8 @@ allocBlock (struct Image* image,
       BAM[16 + (offset - 1) * 6] -= 1;
       BAM[16 + (offset - 1) * 6 + (*sector >> 3) + 1] &= (byte_t)
         ~(1 << (*sector & 7));
+      markDirty (image, BAM);
+      setFreeMap (image, geom, *track, *sector, false);
 
       /* find next free block */
       findNextFree (image, track, sector);
@@ -696,6 +895,7 @@ FormatImage (struct Image* image)
 
   /* Clear all sectors */
   memset (image->buf, 0, geom->blocks * 256);
+  memset (image->dirtyMap, 0xFF, sizeof image->dirtyMap);
 
   switch (image->type) {
     byte_t track, sector;
@@ -737,6 +937,7 @@ FormatImage (struct Image* image)
     }
 
     /* Allocate the BAM and directory entries. */
+    readFreeMap (image);
     track = image->dirtrack;
     sector = 0;
     allocBlock (image, &track, &sector);
@@ -790,6 +991,7 @@ FormatImage (struct Image* image)
     }
 
     /* Allocate the BAM and directory entries. */
+    readFreeMap (image);
     track = image->dirtrack;
     sector = 0;
     allocBlock (image, &track, &sector);
@@ -880,35 +1082,37 @@ FormatImage (struct Image* image)
       tmp[1] = tmp[2] = tmp[3] = tmp[4] = tmp[5] = 0xff;
     }
 
+    readFreeMap (image);
     break;
   }
 }
 
-/** Read a file starting at the specified track and sector to a buffer
- * @param buf           the buffer
+/** Map the contents of a file to segments of the disk image
+ * @param segments      (output) the segments; room for geom->blocks entries
  * @param image         the disk image
  * @param track         track number of the file's first block
  * @param sector        sector number of the file's first block
- * @return              the file length, or 0 on error
+ * @param length        (output) the length of the file
+ * @return              the number of segments (0 on failure)
  */
 static size_t
-readInode (byte_t** buf,
-           const struct Image* image,
-           byte_t track, byte_t sector)
+readSegments (struct Segment* segments,
+              const struct Image* image,
+              byte_t track, byte_t sector,
+              size_t* length)
 {
   const struct DiskGeometry* geom;
   byte_t t, s;
-  size_t size;
+  size_t count;
 
-  if (!buf || *buf ||
+  if (!segments || !length ||
       !image || !image->buf || !(geom = getGeometry (image->type)))
     return 0;
 
-  /* Determine the file size. */
-  for (t = track, s = sector, size = 0; t; size += 254) {
+  for (t = track, s = sector, count = 0; t; count++) {
     const byte_t* block;
 
-    if (size > 254 * geom->blocks)
+    if (count >= geom->blocks)
       return 0; /* endless file */
 
     if (!(block = getBlock ((struct Image*) image, t, s)))
@@ -917,26 +1121,133 @@ readInode (byte_t** buf,
     if (isFreeBlock (image, t, s))
       return 0;
 
+    segments[count].data = &block[2];
+    segments[count].length = 254;
+
     t = block[0];
     s = block[1];
   }
 
-  if (s < 2)
+  if (!count || s < 2)
     return 0; /* The last byte pointer must be at least 2. */
 
-  size += s - 255;
-  if (!(*buf = malloc (size)))
+  segments[count - 1].length = s - 1;
+  *length = 254 * (count - 1) + s - 1;
+  return count;
+}
+
+/** Copy the contents of segments to a buffer
+ * @param buf           the buffer
+ * @param segments      the segments
+ * @param count         number of segments
+ */
+static void
+gatherSegments (byte_t* buf, const struct Segment* segments, size_t count)
+{
+  for (; count--; buf += segments++->length)
+    memcpy (buf, segments->data, segments->length);
+}
+
+/** Read a file starting at the specified track and sector to a buffer
+ * @param buf           (output) the buffer, allocated from image->arena
+ * @param image         the disk image
+ * @param segments      work area for the blocks of the file
+ *                      (as many elements as the disk image has blocks)
+ * @param track         track number of the file's first block
+ * @param sector        sector number of the file's first block
+ * @return              the file length, or 0 on error
+ */
+static size_t
+readInode (byte_t** buf,
+           struct Image* image,
+           struct Segment* segments,
+           byte_t track, byte_t sector)
+{
+  size_t count, length = 0;
+
+  if (!buf || *buf || !image || !image->buf)
     return 0;
 
-  /* Read the file. */
-  for (t = track, s = sector, size = 0; t; size += 254) {
-    const byte_t* block = getBlock ((struct Image*) image, t, s);
-    t = block[0];
-    s = block[1];
-    memcpy (&(*buf)[size], &block[2], t ? 254 : s - 1);
+  /* Walk the chain once, and copy the blocks that it consists of. */
+  if ((count = readSegments (segments, image, track, sector, &length)) &&
+      (*buf = arenaAlloc (&image->arena, length)))
+    gatherSegments (*buf, segments, count);
+  else
+    length = 0;
+
+  return length;
+}
+
+/** A chain of blocks in a chain cache */
+struct Chain
+{
+  /** index of the first segment of the chain in ChainCache::segments */
+  size_t first;
+  /** number of blocks in the chain (0=not mapped) */
+  size_t count;
+  /** length of the chain contents in bytes */
+  size_t length;
+};
+
+/** Block chains of a disk image, by the number of their first block */
+struct ChainCache
+{
+  /** the chains (geom->blocks entries, or NULL) */
+  struct Chain* chains;
+  /** segments of the chains */
+  struct Segment* segments;
+  /** number of segments in use */
+  size_t count;
+  /** number of allocated segments */
+  size_t size;
+};
+
+/** Map a chain of blocks, or look it up in a chain cache
+ * @param cache         the chain cache
+ * @param image         the disk image
+ * @param track         track number of the first block
+ * @param sector        sector number of the first block
+ * @return              the chain, or NULL on failure
+ */
+static const struct Chain*
+mapChain (struct ChainCache* cache,
+          const struct Image* image,
+          byte_t track, byte_t sector)
+{
+  const struct DiskGeometry* geom;
+  struct Chain* chain;
+
+  if (!image || !image->buf || !(geom = getGeometry (image->type)) ||
+      !getBlock ((struct Image*) image, track, sector))
+    return 0;
+
+  if (!cache->chains &&
+      !(cache->chains = calloc (geom->blocks, sizeof *cache->chains)))
+    return 0;
+
+  chain = &cache->chains[geom->offset1[track - 1] + sector];
+
+  if (chain->count)
+    return chain;
+
+  if (cache->size - cache->count < geom->blocks) {
+    struct Segment* segments;
+    size_t size = cache->size + geom->blocks;
+
+    if (!(segments = realloc (cache->segments, size * sizeof *segments)))
+      return 0;
+
+    cache->segments = segments;
+    cache->size = size;
   }
 
-  return size += s - 255;
+  if (!(chain->count = readSegments (&cache->segments[cache->count],
+                                     image, track, sector, &chain->length)))
+    return 0;
+
+  chain->first = cache->count;
+  cache->count += chain->count;
+  return chain;
 }
 
 /** Make a back-up copy of the disk image's Block Availability Map.
@@ -961,7 +1272,8 @@ backupBAM (const struct Image* image, byte_t** BAM)
     if (!(bamblock = getBlock ((struct Image*) image, image->dirtrack, 0)))
       return false;
 
-    if (!(*BAM = malloc ((size_t) geom->tracks << 2)))
+    if (!(*BAM = arenaAlloc (&((struct Image*) image)->arena,
+                             (size_t) geom->tracks << 2)))
       return false;
 
     memcpy (*BAM, &bamblock[4], (size_t) geom->tracks << 2);
@@ -972,7 +1284,8 @@ backupBAM (const struct Image* image, byte_t** BAM)
     if (!(bamblock = getBlock ((struct Image*) image, image->dirtrack, 0)))
       return false;
 
-    if (!(*BAM = malloc ((size_t) geom->tracks << 2)))
+    if (!(*BAM = arenaAlloc (&((struct Image*) image)->arena,
+                             (size_t) geom->tracks << 2)))
       return false;
 
     memcpy (*BAM, &bamblock[4], 35 << 2);
@@ -983,17 +1296,29 @@ backupBAM (const struct Image* image, byte_t** BAM)
 
   case Im1581:
     {
+      struct Arena* arena = &((struct Image*) image)->arena;
       byte_t** bamblocks = 0;
-      bool ok = 2 == mapInode (&bamblocks, (struct Image*) image,
-                               image->dirtrack, 1, 0, 0) &&
-        !!(*BAM = malloc (2 << 8));
+      bool ok;
+
+      /* Allocate the backup first, so that bamblocks can be freed. */
+      if (!(*BAM = arenaAlloc (arena, 2 << 8)))
+        return false;
+
+      ok = 2 == mapInode (&bamblocks, (struct Image*) image,
+                          image->dirtrack, 1, 0, 0);
 
       if (ok) {
         memcpy (*BAM, bamblocks[0], 256);
         memcpy (*BAM + 256, bamblocks[1], 256);
       }
 
-      free (bamblocks);
+      arenaFree (arena, bamblocks);
+
+      if (!ok) {
+        arenaFree (arena, *BAM);
+        *BAM = 0;
+      }
+
       return ok;
     }
   }
@@ -1027,10 +1352,12 @@ restoreBAM (struct Image* image, byte_t** BAM)
         return false;
 
       memcpy (&bamblock[4], *BAM, (size_t) geom->tracks << 2);
+      markDirty (image, bamblock);
     }
   done:
-    free (*BAM);
+    arenaFree (&image->arena, *BAM);
     *BAM = 0;
+    readFreeMap (image);
 
     return true;
   case Im1571:
@@ -1044,6 +1371,8 @@ restoreBAM (struct Image* image, byte_t** BAM)
       memcpy (&bamblock[0xDD], *BAM + (35 << 2), 35);
 
       memcpy (&bamblock[683 << 8], *BAM + 35 * 5, 35 * 3);
+      markDirty (image, bamblock);
+      markDirty (image, &bamblock[683 << 8]);
       goto done;
     }
   case Im1581:
@@ -1051,14 +1380,16 @@ restoreBAM (struct Image* image, byte_t** BAM)
       byte_t** bamblocks = 0;
 
       if (2 != mapInode (&bamblocks, image, image->dirtrack, 1, 0, 0)) {
-        free (bamblocks);
+        arenaFree (&image->arena, bamblocks);
         return false;
       }
 
       memcpy (bamblocks[0], *BAM, 256);
       memcpy (bamblocks[1], *BAM + 256, 256);
+      markDirty (image, bamblocks[0]);
+      markDirty (image, bamblocks[1]);
 
-      free (bamblocks);
+      arenaFree (&image->arena, bamblocks);
       goto done;
     }
   }
@@ -1105,6 +1436,8 @@ writeInode (struct Image* image,
       return WrNoSpace;
     }
 
+    markDirty (image, block);
+
     if (count + 254 < size) { /* not yet last block */
       block[0] = t;
       block[1] = s;
@@ -1117,7 +1450,7 @@ writeInode (struct Image* image,
     }
   }
 
-  free (oldBAM);
+  arenaFree (&image->arena, oldBAM);
   return WrOK;
 }
 
@@ -1159,6 +1492,9 @@ freeBlock (struct Image* image, byte_t track, byte_t sector)
       BAM[0xDC + tr]++;
       /* free the block */
       BAM2[((tr - 1) * 3) + (sector >> 3)] |= (byte_t) (1 << (sector & 7));
+      markDirty (image, BAM);
+      markDirty (image, BAM2);
+      setFreeMap (image, geom, track, sector, true);
       return true;
     }
     /* fall through */
@@ -1170,11 +1506,14 @@ freeBlock (struct Image* image, byte_t track, byte_t sector)
     BAM[track << 2]++;
     /* free the block */
     BAM[(track << 2) + 1 + (sector >> 3)] |= (byte_t) (1 << (sector & 7));
+    markDirty (image, BAM);
+    setFreeMap (image, geom, track, sector, true);
     return true;
 
   case Im1581:
     {
       byte_t** BAMblocks = 0;
+      byte_t offset;
       size_t s;
 
       if (track > image->partTops[image->dirtrack - 1] ||
@@ -1185,18 +1524,22 @@ freeBlock (struct Image* image, byte_t track, byte_t sector)
 
       if (track > 40) {
         BAM = BAMblocks[1];
-        track -= 40;
+        offset = track - 40;
       }
-      else
+      else {
         BAM = BAMblocks[0];
+        offset = track;
+      }
 
-      free (BAMblocks);
+      arenaFree (&image->arena, BAMblocks);
 
       if (2 != s)
         return false;
 
-      BAM[16 + (track - 1) * 6] += 1;
-      BAM[16 + (track - 1) * 6 + (sector >> 3) + 1] |= (byte_t) (1 << (sector & 7));
+      BAM[16 + (offset - 1) * 6] += 1;
+      BAM[16 + (offset - 1) * 6 + (sector >> 3) + 1] |= (byte_t) (1 << (sector & 7));
+      markDirty (image, BAM);
+      setFreeMap (image, geom, track, sector, true);
       return true;
     }
   }
@@ -1245,135 +1588,337 @@ deleteInode (struct Image* image,
       s = block[1];
       /* clear the block */
       memset (block, 0, 256);
+      markDirty (image, block);
     }
   }
 
   return ImOK;
 }
 
-/** Find the directory corresponding to a file
- * @param image the disk image
+/** Number of hash chains in a directory index */
+#define DIRHASH 256
+
+/** Hash index of the directory of a disk image */
+struct DirIndex
+{
+  /** the directory entries, in directory order */
+  struct DirEnt** slots;
+  /** hash chain successors of the directory entries, plus 1 (0=none) */
+  size_t* next;
+  /** number of directory entries */
+  size_t count;
+  /** number of allocated elements in slots[] and next[] */
+  size_t size;
+  /** the first block of the last directory sector */
+  struct DirEnt* last;
+  /** index of the first directory entry in the last directory sector */
+  size_t lastBase;
+  /** lower bound for the index of the first unused directory entry */
+  size_t free;
+  /** index of the entry last returned by getDirEnt(), plus 1 (0=none) */
+  size_t pending;
+  /** the hash chain that the pending entry is linked to */
+  unsigned pendingHash;
+  /** the first directory entries of the hash chains, plus 1 (0=empty) */
+  size_t chains[DIRHASH];
+};
+
+/** Compute the hash value of a file name
  * @param name  the Commodore file name
- * @return      the corresponding directory entry, or NULL
+ * @return      the hash chain number
  */
-static struct DirEnt*
-getDirEnt (struct Image* image,
-           const struct Filename* name)
+static unsigned
+hashName (const byte_t* name)
+{
+  unsigned h = 0, i;
+
+  for (i = 0; i < 16; i++)
+    h = h * 31 + name[i];
+
+  return h % DIRHASH;
+}
+
+/** Make room for more entries in a directory index
+ * @param index the directory index
+ * @param n     the number of entries to be added
+ * @return      true if the operation succeeded
+ */
+static bool
+growDirIndex (struct DirIndex* index, size_t n)
+{
+  struct DirEnt** slots;
+  size_t* next;
+  size_t size;
+
+  if (index->count + n <= index->size)
+    return true;
+
+  size = index->size ? index->size * 2 : 256 / sizeof (struct DirEnt);
+  if (size < index->count + n)
+    size = index->count + n;
+
+  if (!(slots = realloc (index->slots, size * sizeof *slots)))
+    return false;
+  index->slots = slots;
+  if (!(next = realloc (index->next, size * sizeof *next)))
+    return false;
+  index->next = next;
+  index->size = size;
+  return true;
+}
+
+/** Link a directory entry to a hash chain.
+ * The chains are kept in descending order of directory entry index.
+ * @param index the directory index
+ * @param slot  index of the directory entry
+ * @param hash  the hash chain number
+ */
+static void
+linkDirSlot (struct DirIndex* index, size_t slot, unsigned hash)
+{
+  size_t* prev = &index->chains[hash];
+
+  while (*prev > slot + 1)
+    prev = &index->next[*prev - 1];
+
+  index->next[slot] = *prev;
+  *prev = slot + 1;
+}
+
+/** Remove a directory entry from a hash chain
+ * @param index the directory index
+ * @param slot  index of the directory entry
+ * @param hash  the hash chain number
+ */
+static void
+unlinkDirSlot (struct DirIndex* index, size_t slot, unsigned hash)
+{
+  size_t* prev = &index->chains[hash];
+
+  while (*prev && *prev != slot + 1)
+    prev = &index->next[*prev - 1];
+
+  if (*prev)
+    *prev = index->next[slot];
+}
+
+/** Append a directory entry to a directory index
+ * whose size has been reserved by growDirIndex().
+ * @param index         the directory index
+ * @param dirent        the directory entry
+ */
+static void
+addDirSlot (struct DirIndex* index, struct DirEnt* dirent)
+{
+  index->slots[index->count] = dirent;
+  linkDirSlot (index, index->count++, hashName (dirent->name));
+}
+
+/** Deallocate a directory index
+ * @param index the directory index (may be NULL)
+ */
+static void
+freeDirIndex (struct DirIndex* index)
+{
+  if (index) {
+    free (index->slots);
+    free (index->next);
+    free (index);
+  }
+}
+
+/** Build the hash index of the directory of a disk image
+ * @param image the disk image
+ * @return      the directory index, or NULL on failure
+ */
+static struct DirIndex*
+indexDirectory (struct Image* image)
 {
   const struct DiskGeometry* geom;
   byte_t** directory = 0;
-  struct DirEnt* dirent = 0;
-  size_t block, i;
-  size_t freeslotBlock = (size_t) -1, freeslotEntry = 0;
+  struct DirIndex* index;
+  size_t blocks, block, i;
 
-  if (!name || !image || !image->buf || !(geom = getGeometry (image->type)))
+  if (!image || !image->buf || !(geom = getGeometry (image->type)))
     return 0;
 
   /* Read the current directory. */
 
-  if (!(block = mapInode (&directory, image, image->dirtrack, 0, 0, 0)))
+  if (!(blocks = mapInode (&directory, image, image->dirtrack, 0, 0, 0)))
     return 0;
 
   /* Check that the directory is long enough to hold the BAM blocks
      and at least one directory sector */
-  if (block < geom->BAMblocks) {
-    free (directory);
+  if (blocks < geom->BAMblocks ||
+      !(index = calloc (1, sizeof *index))) {
+    arenaFree (&image->arena, directory);
     return 0;
   }
 
-  /* Search for the name in the directory. */
-  for (block = geom->BAMblocks; ; block++) {
-    dirent = (struct DirEnt*) directory[block];
-
-    for (i = 0; i * sizeof (struct DirEnt) < (dirent->nextTrack
-                                              ? 256U
-                                              : dirent->nextSector);
-         i++) {
-      if (freeslotBlock == (size_t) -1 && !dirent[i].type) {
-        /* null file type => unused slot */
-        freeslotBlock = block;
-        freeslotEntry = i;
-      }
+  for (block = geom->BAMblocks; block < blocks; block++) {
+    struct DirEnt* dirent = (struct DirEnt*) directory[block];
 
-      if (image->direntOpts < DirEntDupCreate &&
-          !memcmp (dirent[i].name, name->name, 16)) {
-        free (directory);
-        return &dirent[i];
-      }
+    if (!growDirIndex (index, 256 / sizeof *dirent)) {
+      freeDirIndex (index);
+      arenaFree (&image->arena, directory);
+      return 0;
     }
 
+    index->last = dirent;
+    index->lastBase = index->count;
+
+    for (i = 0; i * sizeof *dirent < (dirent->nextTrack
+                                      ? 256U
+                                      : dirent->nextSector);
+         i++)
+      addDirSlot (index, &dirent[i]);
+
     if (!dirent->nextTrack)
       break;
   }
 
-  /* The name was not found in the directory. */
+  arenaFree (&image->arena, directory);
+  return index;
+}
 
-  if (image->direntOpts == DirEntDontCreate) {
-    free (directory);
-    return 0;
+/** Bring a directory index up to date with the directory entry
+ * that was last returned by getDirEnt() and possibly modified by the caller.
+ * @param index the directory index
+ */
+static void
+syncDirIndex (struct DirIndex* index)
+{
+  if (index->pending) {
+    size_t slot = index->pending - 1;
+
+    unlinkDirSlot (index, slot, index->pendingHash);
+    linkDirSlot (index, slot, hashName (index->slots[slot]->name));
+
+    if (!index->slots[slot]->type && slot < index->free)
+      index->free = slot;
+
+    index->pending = 0;
   }
+}
 
-  if (freeslotBlock == (size_t) -1) {
-    /* Append a directory entry */
-    dirent = (struct DirEnt*) directory[block];
+/** Find the directory corresponding to a file
+ * @param image the disk image
+ * @param name  the Commodore file name
+ * @return      the corresponding directory entry, or NULL
+ */
+static struct DirEnt*
+getDirEnt (struct Image* image,
+           const struct Filename* name)
+{
+  const struct DiskGeometry* geom;
+  struct DirIndex* index;
+  struct DirEnt* dirent;
+  size_t slot;
 
-    if (i < 256 / sizeof *dirent) {
-      /* grow the directory by growing its last sector */
+  if (!name || !image || !image->buf || !(geom = getGeometry (image->type)))
+    return 0;
+
+  /* Index the directory on first use. */
+
+  if (!(index = image->dirIndex) &&
+      !(index = image->dirIndex = indexDirectory (image)))
+    return 0;
+
+  syncDirIndex (index);
 
-      dirent->nextSector = (byte_t)
-        ((sizeof *dirent) * (1 + dirent->nextSector / sizeof *dirent));
-      freeslotBlock = block;
-      freeslotEntry = i;
+  /* Search for the name in the directory. */
+  if (image->direntOpts < DirEntDupCreate) {
+    unsigned hash = hashName (name->name);
+    size_t found = 0;
+
+    /* Look for the first matching entry in the directory order. */
+    for (slot = index->chains[hash]; slot; slot = index->next[slot - 1])
+      if (!memcmp (index->slots[slot - 1]->name, name->name, 16))
+        found = slot;
+
+    if (found) {
+      index->pending = found;
+      index->pendingHash = hash;
+      markDirty (image, index->slots[found - 1]);
+      return index->slots[found - 1];
     }
-    else {
-      /* allocate a new directory block */
+  }
 
-      byte_t track, sector;
-      byte_t t, s;
+  /* The name was not found in the directory. */
 
-      track = image->dirtrack;
-      sector = geom->BAMblocks;
+  if (image->direntOpts == DirEntDontCreate)
+    return 0;
 
-      if (!findNextFree (image, &track, &sector)) {
-        free (directory);
-        return 0;
-      }
+  /* null file type => unused slot */
+  while (index->free < index->count && index->slots[index->free]->type)
+    index->free++;
 
-      t = dirent->nextTrack = track;
-      s = dirent->nextSector = sector;
+  if (index->free < index->count)
+    dirent = index->slots[slot = index->free];
+  else if (!growDirIndex (index, 256 / sizeof *dirent))
+    return 0;
+  else if ((slot = index->count - index->lastBase) < 256 / sizeof *dirent) {
+    /* grow the directory by growing its last sector */
 
-      if (!allocBlock (image, &t, &s)) {
-        dirent->nextTrack = 0;
-        dirent->nextSector = 0xFF;
-        free (directory);
-        return 0;
-      }
+    dirent = index->last;
+    dirent->nextSector = (byte_t)
+      ((sizeof *dirent) * (1 + dirent->nextSector / sizeof *dirent));
+    markDirty (image, dirent);
 
-      /* Remap the directory from the disk image */
+    while ((index->count - index->lastBase) * sizeof *dirent <
+           dirent->nextSector)
+      addDirSlot (index, &dirent[index->count - index->lastBase]);
 
-      free (directory);
-      directory = 0;
+    dirent = &dirent[slot];
+    slot += index->lastBase;
+  }
+  else {
+    /* allocate a new directory block */
 
-      if (!mapInode ((byte_t***)&directory, image, image->dirtrack, 0, 0, 0))
-        return 0;
+    byte_t track, sector;
+    byte_t t, s;
+
+    dirent = index->last;
+    track = image->dirtrack;
+    sector = geom->BAMblocks;
 
-      block++;
+    if (!findNextFree (image, &track, &sector))
+      return 0;
 
-      /* initialize the new directory block */
-      memset (directory[block], 0, 256);
-      ((struct DirEnt*) directory[block])->nextSector = 0xFF;
+    t = dirent->nextTrack = track;
+    s = dirent->nextSector = sector;
 
-      freeslotBlock = block;
-      freeslotEntry = 0;
+    if (!allocBlock (image, &t, &s)) {
+      dirent->nextTrack = 0;
+      dirent->nextSector = 0xFF;
+      return 0;
     }
+
+    markDirty (image, dirent);
+
+    /* initialize the new directory block */
+    dirent = (struct DirEnt*) getBlock (image, track, sector);
+    memset (dirent, 0, 256);
+    dirent->nextSector = 0xFF;
+
+    index->last = dirent;
+    slot = index->lastBase = index->count;
+
+    while (index->count - index->lastBase < 256 / sizeof *dirent)
+      addDirSlot (index, &dirent[index->count - index->lastBase]);
+  }
+
+  /* The caller may modify the entry; re-hash it on the next call. */
+  if (slot < index->count) {
+    index->pending = slot + 1;
+    index->pendingHash = hashName (dirent->name);
   }
 
   /* Clear the directory entry. */
 
-  dirent = &((struct DirEnt*) directory[freeslotBlock])[freeslotEntry];
-  free (directory);
+  markDirty (image, dirent);
 
-  if (freeslotEntry)
+  if (((byte_t*) dirent - image->buf) % 256)
     memset (dirent, 0, sizeof *dirent);
   else
     memset (&dirent->type, 0, (sizeof *dirent) - 2);
@@ -1442,6 +1987,34 @@ getFiletype (const struct Image* image,
   return type;
 }
 
+/** Mark a directory entry unused
+ * @param image         the disk image
+ * @param dirent        the directory entry
+ */
+static void
+dropDirEnt (struct Image* image,
+            struct DirEnt* dirent)
+{
+  struct DirIndex* index = image->dirIndex;
+
+  dirent->type = NUL;
+  markDirty (image, dirent);
+
+  if (index) {
+    size_t slot;
+
+    syncDirIndex (index);
+
+    for (slot = index->chains[hashName (dirent->name)]; slot;
+         slot = index->next[slot - 1])
+      if (index->slots[slot - 1] == dirent) {
+        if (slot - 1 < index->free)
+          index->free = slot - 1;
+        break;
+      }
+  }
+}
+
 /** Remove a directory entry and the files it is pointing to
  * @param image         the disk image
  * @param dirent        the directory entry
@@ -1487,7 +2060,7 @@ deleteDirEnt (struct Image* image,
     /* Delete the info block and the file. */
     deleteInode (image, dirent->infoTrack, dirent->infoSector, true);
     deleteInode (image, dirent->firstTrack, dirent->firstSector, true);
-    dirent->type = NUL;
+    dropDirEnt (image, dirent);
     return ImOK;
   }
   else if (getFiletype (image, dirent) == REL &&
@@ -1501,7 +2074,7 @@ deleteDirEnt (struct Image* image,
 
   if (status == ImOK)
     /* nuke the directory entry */
-    dirent->type = NUL;
+    dropDirEnt (image, dirent);
 
   return status;
 }
@@ -1561,7 +2134,7 @@ blocksFree (const struct Image* image)
           sum += BAMblocks[1][16 + (track - 41) * 6];
       }
 
-      free (BAMblocks);
+      arenaFree (&((struct Image*) image)->arena, BAMblocks);
       return sum;
     }
   }
@@ -1609,12 +2182,13 @@ setupSideSectors (struct Image* image,
     byte_t* buf;
     size_t sslength = 14 + 254 * (sscount - 1) + 2 * (blocks % 120);
 
-    if (!(buf = calloc (sslength, 1)))
+    if (!(buf = arenaAlloc (&image->arena, sslength)))
       return WrFail;
 
+    memset (buf, 0, sslength);
     status = writeInode (image, dirent->ssTrack, dirent->ssSector,
                          buf, sslength);
-    free (buf);
+    arenaFree (&image->arena, buf);
   }
 
   if (status == WrOK) {
@@ -1662,8 +2236,8 @@ setupSideSectors (struct Image* image,
     }
 
   Done:
-    free (datafile);
-    free (sidesect);
+    arenaFree (&image->arena, sidesect);
+    arenaFree (&image->arena, datafile);
   }
 
   return status;
@@ -1744,8 +2318,8 @@ checkSideSectors (const struct Image* image,
 
   ok = true;
  Done:
-  free (datafile);
-  free (sidesect);
+  arenaFree (&((struct Image*) image)->arena, sidesect);
+  arenaFree (&((struct Image*) image)->arena, datafile);
   return ok;
 }
 
@@ -2065,8 +2639,10 @@ WriteCpmImage (const struct Filename* name,
               de->block[(j / au) * 2 + 1] = (byte_t) (freeblock >> 8);
             }
             /* Pad it with ^Z */
-            for (k = 0; k < au / 2; k++)
+            for (k = 0; k < au / 2; k++) {
               memset (trans[(au / 2) * freeblock + k], 0x1A, 256);
+              markDirty (image, trans[(au / 2) * freeblock + k]);
+            }
           }
 
           /* Copy the block */
@@ -2081,8 +2657,10 @@ WriteCpmImage (const struct Filename* name,
   /* Write the directory entries */
   {
     unsigned d = au;
-    while (d--)
+    while (d--) {
       memcpy (trans[d], &dirent[d * 8], 8 * sizeof (*dirent));
+      markDirty (image, trans[d]);
+    }
   }
 
   status = WrOK;
@@ -2153,25 +2731,18 @@ ReadCpmImage (FILE* file,
 
     /* Initialize the disk image structure. */
 
-    if (!(image.buf = malloc (length))) {
-      (*log) (Errors, 0, "Out of memory");
-      return RdFail;
-    }
-
     image.type = geom->type;
     image.dirtrack = geom->dirtrack;
     image.name = 0;
+    image.arena.chunk = 0;
 
-    if (1 != fread (image.buf, length, 1, file)) {
-      (*log) (Errors, 0, "fread: %s", strerror(errno));
-      free (image.buf);
+    if (!loadImage (&image, file, length, log))
       return RdFail;
-    }
 
     /* Get the CP/M sector translations. */
 
     if (!(trans = CpmTransTable (&image, &au, &sectors))) {
-      free (image.buf);
+      unloadImage (&image);
       goto unknownImage;
     }
   }
@@ -2286,7 +2857,7 @@ ReadCpmImage (FILE* file,
 
   status = RdOK;
  Done:
-  free (image.buf);
+  unloadImage (&image);
   free (trans);
 
   return status;
@@ -2502,7 +3073,7 @@ WriteImage (const struct Filename* name,
         }
       }
 
-      free (oldBAM);
+      arenaFree (&image->arena, oldBAM);
     }
 
     dirent->type = *data;
@@ -2598,7 +3169,7 @@ WriteImage (const struct Filename* name,
     case SEQ:
     case PRG:
     case USR:
-      free (oldBAM);
+      arenaFree (&image->arena, oldBAM);
 
       dirent->type = (byte_t) (name->type | 0x80);
       return WrOK;
@@ -2630,6 +3201,8 @@ ReadImage (FILE* file,
 {
   const struct DiskGeometry* geom = 0;
   struct Image image;
+  struct Segment* segments = 0;
+  struct ChainCache cache;
   enum RdStatus status = RdFail;
 
   (void) filename; /* unused */
@@ -2671,18 +3244,26 @@ ReadImage (FILE* file,
 
     /* Initialize the disk image structure. */
 
-    if (!(image.buf = malloc (length))) {
-      (*log) (Errors, 0, "Out of memory");
-      return RdFail;
-    }
-
     image.type = geom->type;
     image.dirtrack = geom->dirtrack;
     image.name = 0;
+    image.arena.chunk = 0;
+    image.partTops[image.dirtrack - 1] = geom->tracks;
+    image.partBots[image.dirtrack - 1] = 1;
+    image.partUpper[image.dirtrack - 1] = 0;
 
-    if (1 != fread (image.buf, length, 1, file)) {
-      (*log) (Errors, 0, "fread: %s", strerror(errno));
-      goto Done;
+    if (!loadImage (&image, file, length, log))
+      return RdFail;
+
+    readFreeMap (&image);
+
+    memset (&cache, 0, sizeof cache);
+
+    /* Pass the files without copying them, if possible. */
+    if (!(segments = malloc (geom->blocks * sizeof *segments))) {
+      (*log) (Errors, 0, "Out of memory");
+      unloadImage (&image);
+      return RdFail;
     }
   }
 
@@ -2716,6 +3297,9 @@ ReadImage (FILE* file,
         name.type = getFiletype (&image, dirent);
         name.recordLength = dirent->recordLength;
 
+        if (locateFile)
+          (*locateFile) (-1, dirent->firstTrack, dirent->firstSector);
+
         if (isGeosDirEnt (dirent)) {
           static const char cvt[] = "PRG formatted GEOS file V1.0";
           size_t length = 0;
@@ -2742,24 +3326,22 @@ ReadImage (FILE* file,
                        geom->sectors1[vlir[2 * vlirblock] - 1])
                 goto notGEOS;
               else {
-                byte_t* b = 0;
-                size_t chainlen = readInode (&b, &image,
-                                             vlir[2 * vlirblock],
-                                             vlir[2 * vlirblock + 1]);
-                if (!chainlen)
+                const struct Chain* chain = mapChain (&cache, &image,
+                                                      vlir[2 * vlirblock],
+                                                      vlir[2 * vlirblock + 1]);
+                if (!chain)
                   goto notGEOS;
 
-                free (b);
-                length = 254 * rounddiv(length, 254) + chainlen;
+                length = 254 * rounddiv(length, 254) + chain->length;
               }
           }
           else {
-            byte_t* b = 0;
-            length = readInode (&b, &image,
-                                dirent->firstTrack, dirent->firstSector);
-            if (!length)
+            const struct Chain* chain = mapChain (&cache, &image,
+                                                  dirent->firstTrack,
+                                                  dirent->firstSector);
+            if (!chain)
               goto notGEOS;
-            free (b);
+            length = chain->length;
           }
 
           /* convert the GEOS file name and type */
@@ -2795,15 +3377,18 @@ ReadImage (FILE* file,
             (*log) (Warnings, &name, "invalid block count");
           }
 
-          if (!(buf = calloc ((2U + dirent->isVLIR) * 254U + length, 1))) {
+          if (!(buf = arenaAlloc (&image.arena,
+                                  (2U + dirent->isVLIR) * 254U + length))) {
             (*log) (Errors, &name, "Out of memory");
             goto ReadDone;
           }
 
+          memset (buf, 0, (2U + dirent->isVLIR) * 254U + length);
+
           /* set the Convert header data */
           memcpy (&buf[0], &dirent->type, length = sizeof (struct DirEnt) - 2);
           memcpy (&buf[length], cvt, sizeof cvt); length += sizeof cvt;
-          /* the track/sector information was already cleared by calloc() */
+          /* the track/sector information was already cleared by memset() */
           /* buf[1] = buf[2] = buf[0x13] = buf[0x14] = 0; */
 
           /* copy the info block */
@@ -2817,20 +3402,21 @@ ReadImage (FILE* file,
 
             for (length = 3 * 254, vlirblock = 1; vlirblock < 128; vlirblock++)
               if (vlir[2 * vlirblock]) {
-                byte_t* b = 0;
-                size_t chainlen = readInode (&b, &image,
-                                             vlir[2 * vlirblock],
-                                             vlir[2 * vlirblock + 1]);
+                const struct Chain* chain = mapChain (&cache, &image,
+                                                      vlir[2 * vlirblock],
+                                                      vlir[2 * vlirblock + 1]);
+                size_t chainlen;
 
-                if (!chainlen || !b) {
+                if (!chain) {
                   (*log) (Errors, &name, "unable to read VLIR chain!");
                   break;
                 }
 
+                chainlen = chain->length;
                 length = 254 * rounddiv(length, 254);
-                memcpy (&buf[length], b, chainlen);
+                gatherSegments (&buf[length], &cache.segments[chain->first],
+                                chain->count);
                 length += chainlen;
-                free (b);
 
                 if (ended && !wasended) {
                   (*log) (Warnings, &name, "false EOF in VLIR sector");
@@ -2870,16 +3456,16 @@ ReadImage (FILE* file,
               }
           }
           else {
-            byte_t* b = 0;
-            size_t len = readInode (&b, &image,
-                                    dirent->firstTrack, dirent->firstSector);
-            memcpy (&buf[2 * 254], b, len);
-            length = 2 * 254 + len;
-            free (b);
+            const struct Chain* chain = mapChain (&cache, &image,
+                                                  dirent->firstTrack,
+                                                  dirent->firstSector);
+            gatherSegments (&buf[2 * 254], &cache.segments[chain->first],
+                            chain->count);
+            length = 2 * 254 + chain->length;
           }
 
           wrStatus = (*writeCallback) (&name, buf, length);
-          free (buf);
+          arenaFree (&image.arena, buf);
 
           switch (wrStatus) {
           case WrOK:
@@ -2897,7 +3483,7 @@ ReadImage (FILE* file,
         }
         switch (name.type) {
           byte_t* buf;
-          size_t length;
+          size_t length, count;
         case REL:
           if (!checkSideSectors (&image, dirent, log))
             (*log) (Warnings, &name, "error in side sector data");
@@ -2908,14 +3494,25 @@ ReadImage (FILE* file,
         case PRG:
         case USR:
           buf = 0;
-          length = readInode (&buf, &image,
-                              dirent->firstTrack, dirent->firstSector);
+          length = count = 0;
+          if (writeSegments || listFile)
+            count = readSegments (segments, &image, dirent->firstTrack,
+                                  dirent->firstSector, &length);
+          else
+            length = readInode (&buf, &image, segments,
+                                dirent->firstTrack, dirent->firstSector);
           if (name.type != REL && rounddiv(length, 254) !=
               dirent->blocksLow + ((unsigned) dirent->blocksHigh << 8))
             (*log) (Warnings, &name, "invalid block count");
 
-          wrStatus = (*writeCallback) (&name, buf, length);
-          free (buf);
+          if (listFile)
+            wrStatus = (*listFile) (&name, length);
+          else if (writeSegments)
+            wrStatus = (*writeSegments) (&name, segments, count, length);
+          else {
+            wrStatus = (*writeCallback) (&name, buf, length);
+            arenaFree (&image.arena, buf);
+          }
 
           switch (wrStatus) {
           case WrOK:
@@ -2953,11 +3550,13 @@ ReadImage (FILE* file,
     }
 
   ReadDone:
-    free (directory);
+    arenaFree (&image.arena, directory);
   }
 
- Done:
-  free (image.buf);
+  free (cache.chains);
+  free (cache.segments);
+  free (segments);
+  unloadImage (&image);
   return status;
 }
 
@@ -2990,33 +3589,42 @@ OpenImage (const char* filename,
   if (!(*image = calloc (1, sizeof (**image))))
     return ImFail;
 
-  if (!((*image)->buf = malloc (geom->blocks * 256)) ||
-      !((*image)->name = malloc (strlen (filename) + 1))) {
+  if (!((*image)->name = malloc (strlen (filename) + 1))) {
   Failed:
     free ((*image)->name);
-    free ((*image)->buf);
     free (*image);
     *image = 0;
     return ImFail;
   }
 
   strcpy ((char*)(*image)->name, filename);
+  (*image)->size = geom->blocks * 256;
   (*image)->type = type;
   (*image)->direntOpts = direntOpts;
   (*image)->dirtrack = geom->dirtrack;
 
-  if (!(f = fopen (filename, "rb"))) {
+  /* Try to open the image for updating it at CloseImage(). */
+  if (!(f = fopen (filename, "r+b")) && errno != ENOENT)
+    f = fopen (filename, "rb");
+
+  if (!f) {
     if (errno != ENOENT) /* It is OK if the file was not found. */
       goto Failed;
 
     /* Initialize the image */
+    if (!((*image)->buf = malloc (geom->blocks * 256)))
+      goto Failed;
+
     FormatImage (*image);
   }
   else {
-    /* Read in the disk image */
+    /* Map or read in the disk image */
+    long length;
 
-    if (1 != fread ((*image)->buf, geom->blocks * 256, 1, f) ||
-        EOF != fgetc (f)) {
+    if (fseek (f, 0, SEEK_END) || (length = ftell (f)) < 0 ||
+        (size_t) length != geom->blocks * 256 ||
+        fseek (f, 0, SEEK_SET) ||
+        !loadImage (*image, f, geom->blocks * 256, 0)) {
       fclose (f);
       goto Failed;
     }
@@ -3027,6 +3635,7 @@ OpenImage (const char* filename,
   (*image)->partTops[(*image)->dirtrack - 1] = geom->tracks;
   (*image)->partBots[(*image)->dirtrack - 1] = 1;
   (*image)->partUpper[(*image)->dirtrack - 1] = 0;
+  readFreeMap (*image);
 
   return ImOK;
 }
@@ -3041,20 +3650,50 @@ CloseImage (struct Image* image)
 {
   FILE* f;
   const struct DiskGeometry* geom;
+  size_t b, e, dirty;
+  enum ImStatus status;
 
   if (!image || !image->buf || !(geom = getGeometry (image->type)))
     return ImFail;
 
-  if (!(f = fopen ((char*)image->name, "wb")))
-    return errno == ENOSPC ? ImNoSpace : ImFail;
+  freeDirIndex (image->dirIndex);
+  image->dirIndex = 0;
+  arenaRelease (&image->arena);
+
+  /* Count the modified blocks. */
+  for (b = dirty = 0; b < geom->blocks; b++)
+    if (isDirty (image, b))
+      dirty++;
+
+  image->written = dirty << 8;
+
+  /* Write a new image in full, and only the modified blocks otherwise.
+     Do not truncate a mapped file, because the unmodified blocks
+     are read from it. */
+  if (!(f = fopen ((char*)image->name,
+                   dirty == geom->blocks && !image->mapped ? "wb" : "r+b"))) {
+  fail:
+    status = errno == ENOSPC ? ImNoSpace : ImFail;
+    unloadImage (image);
+    return status;
+  }
+
+  for (b = 0; b < geom->blocks; b = e) {
+    while (b < geom->blocks && !isDirty (image, b))
+      b++;
+    for (e = b; e < geom->blocks && isDirty (image, e); e++);
 
-  if (1 != fwrite (image->buf, geom->blocks * 256, 1, f)) {
-    fclose (f);
-    return errno == ENOSPC ? ImNoSpace : ImFail;
+    if (e > b &&
+        (fseek (f, (long) b << 8, SEEK_SET) ||
+         1 != fwrite (&image->buf[b << 8], (e - b) << 8, 1, f))) {
+      fclose (f);
+      goto fail;
+    }
   }
 
-  fclose (f);
-  free (image->buf);
-  image->buf = 0;
+  if (fclose (f))
+    goto fail;
+
+  unloadImage (image);
   return ImOK;
 }
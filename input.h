@@ -44,6 +44,84 @@ typedef __attribute__((nonnull))
 enum WrStatus write_file_t (const struct Filename* name, const byte_t* data,
                             size_t length);
 
+/** Call-back function for writing files without copying their contents
+ * @param name          native (PETSCII) name of the file
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @return              status of the operation
+ */
+typedef __attribute__((nonnull (1)))
+enum WrStatus write_segments_t (const struct Filename* name,
+                                const struct Segment* segments,
+                                size_t count, size_t length);
+
+/** Call-back function that ReadImage() may use instead of write_file_t
+ * (NULL if the files must be written through write_file_t) */
+extern write_segments_t* writeSegments;
+
+/** A file that is being written in chunks */
+struct Sink;
+
+/** Call-back functions for writing files in chunks */
+struct SinkFuncs
+{
+  /** Start writing a file
+   * @param name        native (PETSCII) name of the file
+   * @param sink        (output) the file being written
+   * @return            status of the operation
+   */
+  enum WrStatus (*open) (const struct Filename* name, struct Sink** sink);
+  /** Append to a file
+   * @param sink        the file being written
+   * @param data        the contents to append
+   * @param length      length of the contents
+   * @return            status of the operation
+   */
+  enum WrStatus (*write) (struct Sink* sink,
+                          const byte_t* data, size_t length);
+  /** Finish writing a file
+   * @param sink        the file being written (will be deallocated)
+   * @return            status of the operation, including any failed write
+   */
+  enum WrStatus (*close) (struct Sink* sink);
+};
+
+/** Call-back functions that ReadNative() and ReadPC64() may use instead of
+ * write_file_t (NULL if the files must be written through write_file_t) */
+extern const struct SinkFuncs* writeSink;
+
+/** Call-back function for listing files without reading their contents
+ * @param name          native (PETSCII) name of the file
+ * @param length        length of the file contents
+ * @return              status of the operation
+ */
+typedef __attribute__((nonnull))
+enum WrStatus list_file_t (const struct Filename* name, size_t length);
+
+/** Call-back function that the readers must invoke instead of
+ * write_file_t, skipping the file contents where the format allows
+ * (NULL if the files are being converted) */
+extern list_file_t* listFile;
+
+/** Call-back function for reporting where the contents of the next file
+ * to be written or listed are stored in the input file
+ * @param offset        offset of the contents in bytes,
+ *                      or -1 if they are stored in a track/sector chain
+ * @param track         first track of the chain (0 if offset is not -1)
+ * @param sector        first sector of the chain
+ */
+typedef void locate_file_t (long offset, unsigned track, unsigned sector);
+
+/** Call-back function that the readers invoke before writing or listing
+ * each file whose contents are stored uncompressed, where the format allows
+ * (NULL if the locations are not needed) */
+extern locate_file_t* locateFile;
+
+/** Flag: write the files of an archive in the order of their contents,
+ * instead of the directory order, where the two can differ */
+extern bool storedOrder;
+
 /** Status of a conversion operation */
 enum RdStatus
 {
@@ -32,36 +32,51 @@
 /** maximal length of the BASIC header, if any */
 #define MAXBASICLENGTH 1024
 
+/** A file in the Lynx directory */
+struct LynxEntry
+{
+  /** the file name and type */
+  struct Filename name;
+  /** position of the contents in the archive */
+  long pos;
+  /** length of the contents in bytes */
+  unsigned length;
+};
+
 /** Read and convert a Lynx archive
  * @param file          the file input stream
- * @param filename      host system name of the file
  * @param writeCallback function for writing the contained files
  * @param log           Call-back function for diagnostic output
+ * @param arena         memory arena for the file contents
  * @return              status of the operation
  */
-enum RdStatus
-ReadLynx (FILE* file,
-          const char* filename,
+static enum RdStatus
+readLynx (FILE* file,
           write_file_t writeCallback,
-          log_t log)
+          log_t log,
+          struct Arena* arena)
 {
   struct Filename name;
   unsigned f, fcount;
 
   /* File positions */
-  long headerPos; /* current header position */
   long headerEnd; /* end of header (start of archive) */
   long archivePos; /* current archive position */
+  long archiveEnd = 0; /* end of the archive (only determined for listing) */
 
   bool errNoLength = false; /* set if the file length is unknown */
+  bool hdrFail = false; /* set if the directory could not be parsed */
 
-  (void) filename; /* unused */
+  /** the files in the directory */
+  struct LynxEntry* entries = 0;
+  /** number of files in entries[] */
+  unsigned count = 0;
 
   {
     byte_t* buf;
     size_t i, length;
 
-    if (!(buf = malloc (MAXBASICLENGTH))) {
+    if (!(buf = arenaAlloc (arena, MAXBASICLENGTH))) {
     memError:
       (*log) (Errors, 0, "Out of memory.");
       return RdFail;
@@ -71,7 +86,7 @@ ReadLynx (FILE* file,
 
     if (fseek (file, 0, SEEK_SET)) {
     seekError:
-      free (buf);
+      arenaFree (arena, buf);
       (*log) (Errors, 0, "fseek: %s", strerror(errno));
       return RdFail;
     }
@@ -85,7 +100,7 @@ ReadLynx (FILE* file,
         break;
       }
 
-    free (buf);
+    arenaFree (arena, buf);
   }
 
   /* Determine number of blocks and files */
@@ -103,24 +118,21 @@ ReadLynx (FILE* file,
     }
 
     /* Set the file pointers. */
-    headerPos = ftell (file);
     headerEnd = archivePos = 254 * blkcount;
   }
 
-  /* start extracting files */
+  /* Parse the whole directory first, so that the archive can be read
+     sequentially instead of seeking back and forth between the
+     directory and the file contents. */
 
   for (f = 0; f++ < fcount;) {
     unsigned length, blocks;
 
-    if (headerPos >= headerEnd) {
+    if (ftell (file) >= headerEnd) {
     hdrError:
       (*log) (Errors, 0, "Lynx header error.");
-      return RdFail;
-    }
-
-    if (fseek (file, headerPos, 0)) {
-      (*log) (Errors, 0, "fseek: %s", strerror(errno));
-      return RdFail;
+      hdrFail = true;
+      break;
     }
 
     /* read the file header information */
@@ -142,7 +154,8 @@ ReadLynx (FILE* file,
         default: /* file name character */
           if (i > 15) {
             (*log) (Errors, 0, "Too long file name");
-            return RdFail;
+            hdrFail = true;
+            goto extract;
           }
 
           name.name[i] = (unsigned char) j;
@@ -238,7 +251,8 @@ ReadLynx (FILE* file,
         (*log) (Errors, &name, "illegal length, skipping file");
         (*log) (Errors, &name,
                 "FATAL: the archive may be corrupted from this point on!");
-        continue;
+        /* The remaining files cannot be located. */
+        goto extract;
       }
 
       if (blocks)
@@ -250,58 +264,126 @@ ReadLynx (FILE* file,
         (*log) (Warnings, &name, "non-integer record count");
     }
 
-    headerPos = ftell (file);
+    /* Remember the file */
+    {
+      struct LynxEntry* e =
+        arenaGrow (arena, entries, (count + 1) * sizeof *entries);
 
-    /* Extract the file */
+      if (!e)
+        goto memError;
 
-    {
-      byte_t* buf;
-      size_t readlength;
-      enum WrStatus wrStatus;
+      entries = e;
+      e += count++;
+      e->name = name;
+      e->pos = archivePos;
+      e->length = length;
+    }
+
+    archivePos += 254 * blocks;
+  }
+
+ extract:
+  /* When listing, determine the length of the archive, so that
+     the length of a truncated file can be reported without reading it. */
+  if (listFile && count) {
+    if (fseek (file, 0, SEEK_END) || (archiveEnd = ftell (file)) < 0) {
+      (*log) (Errors, 0, "fseek: %s", strerror(errno));
+      return RdFail;
+    }
+  }
+
+  /* Extract the files */
+
+  for (f = 0; f < count; f++) {
+    const struct LynxEntry* e = &entries[f];
+    byte_t* buf;
+    size_t readlength;
+    enum WrStatus wrStatus;
+
+    if (locateFile)
+      (*locateFile) (e->pos, 0, 0);
 
-      if (fseek (file, archivePos, SEEK_SET)) {
-        (*log) (Errors, &name, "fseek: %s", strerror(errno));
+    if (listFile) {
+      if (e->pos >= archiveEnd)
+        readlength = 0;
+      else if ((unsigned long) (archiveEnd - e->pos) < e->length)
+        readlength = (size_t) (archiveEnd - e->pos);
+      else
+        readlength = e->length;
+
+      if (readlength != e->length)
+        (*log) (Warnings, &e->name, "Truncated file, proceeding anyway");
+
+      wrStatus = (*listFile) (&e->name, readlength);
+    }
+    else {
+      /* The files are in ascending order; seek forward over any gap. */
+      if (ftell (file) != e->pos && fseek (file, e->pos, SEEK_SET)) {
+        (*log) (Errors, &e->name, "fseek: %s", strerror(errno));
         return RdFail;
       }
 
-      if (!(buf = malloc (length)))
+      if (!(buf = arenaAlloc (arena, e->length)))
         goto memError;
 
-      if (length != (readlength = fread (buf, 1, length, file))) {
+      if (e->length != (readlength = fread (buf, 1, e->length, file))) {
         if (feof (file)) {
-          (*log) (Warnings, &name, "Truncated file, proceeding anyway");
+          (*log) (Warnings, &e->name, "Truncated file, proceeding anyway");
         }
         if (ferror (file)) {
-          free (buf);
-          (*log) (Errors, &name, "fread: %s", strerror(errno));
+          arenaFree (arena, buf);
+          (*log) (Errors, &e->name, "fread: %s", strerror(errno));
           return RdFail;
         }
       }
 
-      archivePos += 254 * blocks;
-
-      wrStatus = (*writeCallback) (&name, buf, readlength);
-      free (buf);
+      wrStatus = (*writeCallback) (&e->name, buf, readlength);
+      arenaFree (arena, buf);
+    }
 
-      switch (wrStatus) {
-      case WrOK:
-        continue;
-      case WrNoSpace:
-        return RdNoSpace;
-      case WrFail:
-      case WrFileExists:
-        break;
-      }
-      return RdFail;
+    switch (wrStatus) {
+    case WrOK:
+      continue;
+    case WrNoSpace:
+      return RdNoSpace;
+    case WrFail:
+    case WrFileExists:
+      break;
     }
+    return RdFail;
   }
 
+  if (hdrFail)
+    return RdFail;
+
   if (errNoLength)
     (*log) (Warnings, 0, "The last file may be too long.");
 
   return RdOK;
 }
 
+/** Read and convert a Lynx archive
+ * @param file          the file input stream
+ * @param filename      host system name of the file
+ * @param writeCallback function for writing the contained files
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+enum RdStatus
+ReadLynx (FILE* file,
+          const char* filename,
+          write_file_t writeCallback,
+          log_t log)
+{
+  struct Arena arena = { 0 };
+  enum RdStatus status = readLynx (file, writeCallback, log, &arena);
+
+  (void) filename; /* unused */
+
+  arenaRelease (&arena);
+  return status;
+}
+
 /** Write an archive in Lynx format
  * @param archive       the archive to be written
  * @param filename      host file name of the archive file
@@ -389,6 +471,8 @@ ArchiveLynx (const struct Archive* archive,
 
   /* Write the files. */
 
+  rewind (archive->data);
+
   for (ae = archive->first; ae; ae = ae->next) {
     unsigned blocks = (unsigned) rounddiv(ae->length, 254);
 
@@ -398,7 +482,7 @@ ArchiveLynx (const struct Archive* archive,
 
     /* Write the file. */
     if (fseek (f, blockcounter * 254, SEEK_SET) ||
-        ae->length != fwrite (ae->data, 1, ae->length, f)) {
+        !copyArchive (archive, f, ae->length)) {
       fclose (f);
       return ArFail;
     }
@@ -27,17 +27,20 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "version.h"
 #include "input.h"
 #include "output.h"
 
-/** The default file output function */
-static write_t* writeFunc =
+/** The default file creation function */
+static open_t* openFunc =
 #ifdef WRITE_PC64_DEFAULT
- WritePC64;
+ OpenPC64;
 #else
- WriteNative;
+ OpenNative;
 #endif
 /** The default disk image output function */
 static write_img_t* writeImageFunc = WriteImage;
@@ -51,8 +54,78 @@ static struct Archive* archive = 0;
 static const char* archiveFilename = 0;
 /** Default verbosity level */
 static enum Verbosity verbosityLevel = Warnings;
-/** Current input file name */
-static const char* currentFilename = 0;
+/** Input file name whose messages were displayed last */
+static const char* loggedFilename = 0;
+/** Number of input files to convert concurrently */
+static unsigned jobs = 1;
+/** Whether to write a catalog of the files instead of converting them */
+static bool catalog = false;
+/** Whether to write each distinct catalogued file under its SHA-1 */
+static bool store = false;
+
+/** An input file that is being converted */
+struct Input
+{
+  /** the input file name */
+  const char* filename;
+  /** offset of the contents of the current contained file,
+      or -1 if they are in a track/sector chain or the location is unknown */
+  long offset;
+  /** first track of the current contained file (0 if unknown) */
+  unsigned track;
+  /** first sector of the current contained file */
+  unsigned sector;
+};
+
+#ifdef HAVE_PTHREAD
+/** Mutex protecting the diagnostic output */
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Mutex serializing the writing of files (and choosing their names) */
+static pthread_mutex_t writeMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Mutex protecting the queue of input files */
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Current input file of each thread */
+static pthread_key_t currentInputKey;
+#else
+/** Current input file */
+static struct Input* currentInput = 0;
+#endif
+
+/** Set the input file that the current thread is converting
+ * @param input         the input file (NULL when done)
+ */
+static void
+setCurrentInput (struct Input* input)
+{
+#ifdef HAVE_PTHREAD
+  pthread_setspecific (currentInputKey, input);
+#else
+  currentInput = input;
+#endif
+}
+
+/** Get the input file that the current thread is converting
+ * @return      the input file, or NULL
+ */
+static struct Input*
+getCurrentInput (void)
+{
+#ifdef HAVE_PTHREAD
+  return pthread_getspecific (currentInputKey);
+#else
+  return currentInput;
+#endif
+}
+
+/** Get the name of the input file that the current thread is converting
+ * @return      the input file name, or NULL
+ */
+static const char*
+getCurrentFilename (void)
+{
+  const struct Input* input = getCurrentInput ();
+  return input ? input->filename : 0;
+}
 
 /** Disk image changing policy */
 enum ChangeDisks
@@ -67,6 +140,16 @@ static enum ChangeDisks changeDisks = Sometimes;
 
 /** Whether io allow duplicate file names */
 bool allowDuplicates = false;
+/** Call-back for writing files without copying (NULL=use writeFile()) */
+write_segments_t* writeSegments = 0;
+/** Call-back for writing files in chunks (NULL=use writeFile()) */
+const struct SinkFuncs* writeSink = 0;
+/** Call-back for listing files (NULL=convert the files) */
+list_file_t* listFile = 0;
+/** Call-back for locating files (NULL=not needed) */
+locate_file_t* locateFile = 0;
+/** Whether to write the files of archives in the order of their contents */
+bool storedOrder = false;
 /** Whether io ignore duplicate file names */
 static bool ignoreDuplicates = false;
 
@@ -86,11 +169,16 @@ writeLog (enum Verbosity verbosity,
   static struct Filename oldname;
 
   if (verbosityLevel >= verbosity) {
+    const char* filename = getCurrentFilename ();
     va_list ap;
 
-    if (currentFilename) {
-      fprintf (stderr, "`%s':\n", currentFilename);
-      currentFilename = 0;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock (&logMutex);
+#endif
+
+    if (filename && filename != loggedFilename) {
+      fprintf (stderr, "`%s':\n", filename);
+      loggedFilename = filename;
     }
 
     fputs ("  ", stderr);
@@ -110,6 +198,10 @@ writeLog (enum Verbosity verbosity,
     va_end (ap);
 
     fputc ('\n', stderr);
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock (&logMutex);
+#endif
   }
 }
 
@@ -124,6 +216,424 @@ reportDuplicateName (const struct Filename* name)
   return WrOK;
 }
 
+/** Write a file to the host file system
+ * @param name          native (PETSCII) name of the file
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @return              status of the operation
+ */
+static enum WrStatus
+writeHostFile (const struct Filename* name,
+               const struct Segment* segments,
+               size_t count,
+               size_t length)
+{
+  enum WrStatus status;
+  FILE* f;
+  char* newname = 0;
+
+  /* Only choosing the name and creating the file must be serialized. */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&writeMutex);
+#endif
+  status = (*openFunc) (name, &f, &newname, writeLog);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock (&writeMutex);
+#endif
+
+  if (status == WrOK) {
+    if (!WriteContents (f, segments, count)) {
+      writeLog (Errors, name, "fwrite: %s", strerror (errno));
+      status = errno == ENOSPC ? WrNoSpace : WrFail;
+      fclose (f);
+    }
+    else if (fclose (f)) {
+      writeLog (Errors, name, "fclose: %s", strerror (errno));
+      status = errno == ENOSPC ? WrNoSpace : WrFail;
+    }
+  }
+
+  if (status == WrOK)
+    writeLog (Everything, name, "Writing %zu bytes to \"%s\"",
+              length, newname);
+  else
+    writeLog (Errors, name, "%s while writing to \"%s\"",
+              status == WrNoSpace ? "out of space" : "failed",
+              newname);
+
+  free (newname);
+  return status;
+}
+
+/** Write a file to the host file system without copying it
+ * @param name          native (PETSCII) name of the file
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @return              status of the operation
+ */
+static enum WrStatus
+writeFileSegments (const struct Filename* name,
+                   const struct Segment* segments,
+                   size_t count,
+                   size_t length)
+{
+  if (!length)
+    writeLog (Warnings, name, "Zero length file");
+
+  return writeHostFile (name, segments, count, length);
+}
+
+/** A file that is being written to the host file system in chunks */
+struct Sink
+{
+  /** native (PETSCII) name of the file */
+  struct Filename name;
+  /** the output stream */
+  FILE* file;
+  /** the converted file name */
+  char* newname;
+  /** number of bytes written so far */
+  size_t length;
+  /** status of the writes so far */
+  enum WrStatus status;
+};
+
+/** Start writing a file to the host file system
+ * @param name          native (PETSCII) name of the file
+ * @param sink          (output) the file being written
+ * @return              status of the operation
+ */
+static enum WrStatus
+openHostSink (const struct Filename* name, struct Sink** sink)
+{
+  enum WrStatus status;
+  struct Sink* s;
+
+  if (!(*sink = s = calloc (1, sizeof *s))) {
+    writeLog (Errors, name, "Out of memory.");
+    return WrFail;
+  }
+
+  s->name = *name;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&writeMutex);
+#endif
+  status = (*openFunc) (name, &s->file, &s->newname, writeLog);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock (&writeMutex);
+#endif
+
+  if (status != WrOK) {
+    writeLog (Errors, name, "%s while writing to \"%s\"",
+              status == WrNoSpace ? "out of space" : "failed",
+              s->newname);
+    free (s->newname);
+    free (s);
+    *sink = 0;
+  }
+
+  return status;
+}
+
+/** Append to a file in the host file system
+ * @param sink          the file being written
+ * @param data          the contents to append
+ * @param length        length of the contents
+ * @return              status of the operation
+ */
+static enum WrStatus
+writeHostSink (struct Sink* sink, const byte_t* data, size_t length)
+{
+  if (sink->status == WrOK) {
+    if (length == fwrite (data, 1, length, sink->file))
+      sink->length += length;
+    else {
+      writeLog (Errors, &sink->name, "fwrite: %s", strerror (errno));
+      sink->status = errno == ENOSPC ? WrNoSpace : WrFail;
+    }
+  }
+
+  return sink->status;
+}
+
+/** Finish writing a file to the host file system
+ * @param sink          the file being written (will be deallocated)
+ * @return              status of the operation
+ */
+static enum WrStatus
+closeHostSink (struct Sink* sink)
+{
+  enum WrStatus status = sink->status;
+
+  if (fclose (sink->file) && status == WrOK) {
+    writeLog (Errors, &sink->name, "fclose: %s", strerror (errno));
+    status = errno == ENOSPC ? WrNoSpace : WrFail;
+  }
+
+  if (status != WrOK)
+    writeLog (Errors, &sink->name, "%s while writing to \"%s\"",
+              status == WrNoSpace ? "out of space" : "failed",
+              sink->newname);
+  else {
+    if (!sink->length)
+      writeLog (Warnings, &sink->name, "Zero length file");
+    writeLog (Everything, &sink->name, "Writing %zu bytes to \"%s\"",
+              sink->length, sink->newname);
+  }
+
+  free (sink->newname);
+  free (sink);
+  return status;
+}
+
+/** Call-back functions for writing to the host file system in chunks */
+static const struct SinkFuncs hostSink = {
+  openHostSink, writeHostSink, closeHostSink
+};
+
+/** List a file on the standard output
+ * @param name          native (PETSCII) name of the file
+ * @param length        length of the file contents
+ * @return              status of the operation
+ */
+static enum WrStatus
+listEntry (const struct Filename* name, size_t length)
+{
+  int written;
+
+#ifdef HAVE_PTHREAD
+  /* getFilename() returns a static buffer that writeLog() uses as well. */
+  pthread_mutex_lock (&logMutex);
+#endif
+  written = printf ("%s\t%s\t%lu\n", getCurrentFilename (),
+                    getFilename (name), (unsigned long) length);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock (&logMutex);
+#endif
+
+  if (written < 0) {
+    writeLog (Errors, name, "printf: %s", strerror(errno));
+    return WrFail;
+  }
+
+  return WrOK;
+}
+
+/** Convert bytes to hexadecimal digits
+ * @param buf           (output) 2 * length digits and a terminating NUL
+ * @param data          the bytes
+ * @param length        number of bytes
+ * @return              buf
+ */
+static char*
+toHex (char* buf, const byte_t* data, size_t length)
+{
+  static const char digits[] = "0123456789abcdef";
+  char* b = buf;
+
+  for (; length--; data++) {
+    *b++ = digits[*data >> 4];
+    *b++ = digits[*data & 15];
+  }
+
+  *b = 0;
+  return buf;
+}
+
+/** Determine the length of a UTF-8 encoded character
+ * @param s             the string
+ * @return              the length of the character at s in bytes,
+ *                      or 0 if it is not valid UTF-8
+ */
+static unsigned
+utf8Length (const unsigned char* s)
+{
+  /* the allowed range of the second byte, after a leading byte */
+  unsigned char low = 0x80, high = 0xbf;
+  unsigned length, i;
+
+  if (*s < 0x80)
+    return 1;
+  else if (*s < 0xc2)
+    return 0;
+  else if (*s < 0xe0)
+    length = 2;
+  else if (*s < 0xf0) {
+    length = 3;
+    if (*s == 0xe0)
+      low = 0xa0; /* overlong */
+    else if (*s == 0xed)
+      high = 0x9f; /* surrogate */
+  }
+  else if (*s < 0xf5) {
+    length = 4;
+    if (*s == 0xf0)
+      low = 0x90; /* overlong */
+    else if (*s == 0xf4)
+      high = 0x8f; /* above U+10FFFF */
+  }
+  else
+    return 0;
+
+  if (s[1] < low || s[1] > high)
+    return 0;
+
+  for (i = 2; i < length; i++)
+    if ((s[i] & 0xc0) != 0x80)
+      return 0;
+
+  return length;
+}
+
+/** Write a string in JSON syntax to the standard output.
+ * Bytes that are not part of a valid UTF-8 sequence are written as
+ * the ISO 8859-1 characters of the same code.
+ * @param s             the string
+ */
+static void
+putJSONString (const char* s)
+{
+  putchar ('"');
+
+  while (*s) {
+    unsigned char c = (unsigned char) *s;
+    unsigned length = utf8Length ((const unsigned char*) s);
+
+    if (c == '"' || c == '\\')
+      printf ("\\%c", c);
+    else if (c < 0x20 || !length)
+      printf ("\\u%04x", c);
+    else {
+      fwrite (s, 1, length, stdout);
+      s += length;
+      continue;
+    }
+
+    s++;
+  }
+
+  putchar ('"');
+}
+
+/** Remember where the contents of the next catalogued file are stored
+ * @param offset        offset of the contents in bytes,
+ *                      or -1 if they are stored in a track/sector chain
+ * @param track         first track of the chain (0 if offset is not -1)
+ * @param sector        first sector of the chain
+ */
+static void
+locateEntry (long offset, unsigned track, unsigned sector)
+{
+  struct Input* input = getCurrentInput ();
+
+  input->offset = offset;
+  input->track = track;
+  input->sector = sector;
+}
+
+/** Write a catalog entry of a file to the standard output, and with -S,
+ * write the file to the content-addressed store unless it is there already
+ * @param name          native (PETSCII) name of the file
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @return              status of the operation
+ */
+static enum WrStatus
+catalogFile (const struct Filename* name,
+             const struct Segment* segments,
+             size_t count,
+             size_t length)
+{
+  static const char* const types[] = {
+    "del", "seq", "prg", "usr", "rel", "cbm"
+  };
+  struct Input* input = getCurrentInput ();
+  struct Checksum sum;
+  byte_t sha1[20];
+  char hexName[2 * sizeof name->name + 1], hexSha1[2 * sizeof sha1 + 1];
+  size_t i;
+  bool failed;
+
+  /* Compute the checksums outside the critical section. */
+  checksumInit (&sum);
+  for (i = 0; i < count; i++)
+    checksumUpdate (&sum, segments[i].data, segments[i].length);
+  checksumFinal (&sum, sha1);
+  toHex (hexSha1, sha1, sizeof sha1);
+
+  if (store) {
+    enum WrStatus status;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock (&writeMutex);
+#endif
+    status = WriteStore (hexSha1, segments, count, length,
+                         name, writeLog);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock (&writeMutex);
+#endif
+
+    switch (status) {
+    case WrOK:
+      writeLog (Everything, name, "Writing %zu bytes to \"%s\"",
+                length, hexSha1);
+      break;
+    case WrFileExists:
+      writeLog (Everything, name, "Already stored as \"%s\"", hexSha1);
+      break;
+    case WrNoSpace:
+    case WrFail:
+      writeLog (Errors, name, "%s while writing to \"%s\"",
+                status == WrNoSpace ? "out of space" : "failed", hexSha1);
+      return status;
+    }
+  }
+
+#ifdef HAVE_PTHREAD
+  /* getFilename() returns a static buffer that writeLog() uses as well. */
+  pthread_mutex_lock (&logMutex);
+#endif
+  fputs ("{\"container\":", stdout);
+  putJSONString (input->filename);
+  if (input->offset >= 0)
+    printf (",\"offset\":%ld,\"track\":null,\"sector\":null",
+            input->offset);
+  else if (input->track)
+    printf (",\"offset\":null,\"track\":%u,\"sector\":%u",
+            input->track, input->sector);
+  else
+    fputs (",\"offset\":null,\"track\":null,\"sector\":null", stdout);
+  printf (",\"name\":\"%s\",\"text\":",
+          toHex (hexName, name->name, sizeof name->name));
+  putJSONString (getFilename (name));
+  printf (",\"type\":\"%s\",\"record_length\":%u,\"length\":%lu,"
+          "\"crc32\":\"%08lx\",\"sha1\":\"%s\"}\n",
+          name->type >= DEL && name->type <= CBM ? types[name->type - DEL] : "",
+          name->recordLength, (unsigned long) length,
+          sum.crc, hexSha1);
+  failed = ferror (stdout);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock (&logMutex);
+#endif
+
+  /* Readers that do not know the location of the next file will not
+     report it. */
+  input->offset = -1;
+  input->track = input->sector = 0;
+
+  if (failed) {
+    writeLog (Errors, name, "Could not write the catalog: %s",
+              strerror(errno));
+    return WrFail;
+  }
+
+  return WrOK;
+}
+
 /** Write a file
  * @param name          native (PETSCII) name of the file
  * @param data          the contents of the file
@@ -136,8 +646,18 @@ writeFile (const struct Filename* name,
            size_t length)
 {
   enum WrStatus status = WrFail;
+  struct Segment segment;
 
-  if (!image && !writeFunc)
+  if (listFile)
+    return (*listFile) (name, length);
+
+  segment.data = data;
+  segment.length = length;
+
+  if (catalog)
+    return catalogFile (name, &segment, 1, length);
+
+  if (!image && !openFunc)
     return status;
 
   if (!length)
@@ -188,7 +708,9 @@ writeFile (const struct Filename* name,
         image = 0;
         return status;
       case ImOK:
-        writeLog (Everything, name, "wrote old image \"%s\"", image->name);
+        writeLog (Everything, name,
+                  "wrote old image \"%s\" (%lu of %lu bytes)", image->name,
+                  (unsigned long) image->written, (unsigned long) image->size);
         /*
         ** Update the file name.  If there is a number in the first
         ** component of the file name (excluding any directory component),
@@ -284,26 +806,147 @@ writeFile (const struct Filename* name,
       return WrNoSpace;
     }
   }
-  else {
-    char* newname = 0;
+  else
+    return writeHostFile (name, &segment, 1, length);
 
-    status = (*writeFunc) (name, data, length, &newname, writeLog);
+  return status;
+}
 
-    if (status == WrOK)
-      writeLog (Everything, name, "Writing %zu bytes to \"%s\"",
-                length, newname);
-    else
-      writeLog (Errors, name, "%s while writing to \"%s\"",
-                status == WrNoSpace ? "out of space" : "failed",
-                newname);
+/** Convert an input file
+ * @param readFunc      the input file format
+ * @param filename      the input file name
+ * @return              0 on success, 2 if the file could not be opened,
+ *                      3 if out of space, or 4 on other failure
+ */
+static int
+convertFile (read_file_t* readFunc, const char* filename)
+{
+  FILE* file;
+  struct Input input;
+  int retval = 4;
 
-    free (newname);
-    return status;
+  if (!(file = fopen (filename, "rb"))) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock (&logMutex);
+#endif
+    fprintf (stderr, "fopen '%s': %s\n", filename, strerror(errno));
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock (&logMutex);
+#endif
+    return 2;
   }
 
-  return status;
+  input.filename = filename;
+  input.offset = -1;
+  input.track = input.sector = 0;
+  setCurrentInput (&input);
+
+  switch ((*readFunc) (file, filename, writeFile, writeLog)) {
+  case RdOK:
+    writeLog (Everything, 0, "Archive extracted.");
+    retval = 0;
+    break;
+
+  case RdNoSpace:
+    writeLog (Errors, 0, "out of space.");
+    retval = 3;
+    break;
+
+  case RdFail:
+    writeLog (Errors, 0, "unexpected error.");
+    break;
+  }
+
+  fclose (file);
+  setCurrentInput (0);
+  return retval;
 }
 
+#ifdef HAVE_PTHREAD
+/** Queue of input files for the worker threads */
+static struct
+{
+  /** the input file format */
+  read_file_t* readFunc;
+  /** the input file names */
+  char** files;
+  /** number of input files */
+  int count;
+  /** index of the next input file to convert */
+  int next;
+  /** return status of the program */
+  int retval;
+} queue;
+
+/** Convert input files from the queue until it is empty or an error occurs
+ * @param arg   (unused)
+ * @return      NULL
+ */
+static void*
+convertWorker (void* arg)
+{
+  (void) arg;
+
+  for (;;) {
+    const char* filename;
+    int status;
+
+    pthread_mutex_lock (&queueMutex);
+    filename = queue.next < queue.count ? queue.files[queue.next++] : 0;
+    pthread_mutex_unlock (&queueMutex);
+
+    if (!filename)
+      return 0;
+
+    if (!(status = convertFile (queue.readFunc, filename)))
+      continue;
+
+    pthread_mutex_lock (&queueMutex);
+    if (queue.retval < 3)
+      queue.retval = status;
+    if (status != 2)
+      queue.next = queue.count; /* stop converting */
+    pthread_mutex_unlock (&queueMutex);
+  }
+}
+
+/** Convert input files in a pool of worker threads
+ * @param readFunc      the input file format
+ * @param files         the input file names
+ * @param count         number of input files
+ * @return              0 on success, 2 if some file could not be opened,
+ *                      3 if out of space, or 4 on other failure
+ */
+static int
+convertFiles (read_file_t* readFunc, char** files, int count)
+{
+  pthread_t* threads;
+  unsigned i, n;
+
+  queue.readFunc = readFunc;
+  queue.files = files;
+  queue.count = count;
+  queue.next = 0;
+  queue.retval = 0;
+
+  if (!(threads = malloc (jobs * sizeof *threads)))
+    n = 0;
+  else
+    for (n = 0; n < jobs && n < (unsigned) count; n++)
+      if (pthread_create (&threads[n], 0, convertWorker, 0))
+        break;
+
+  if (!n) /* convert in this thread */
+    convertWorker (0);
+
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], 0);
+
+  free (threads);
+  return queue.retval;
+}
+#endif
+
 /** Convert a disk image type code to a printable string
  * @param im    the disk image type code
  * @return      a corresponding printable character string
@@ -334,7 +977,6 @@ int
 main (int argc, char** argv)
 {
   read_file_t* readFunc = ReadNative;
-  FILE* file;
   char* prog = *argv; /* name of the program */
   int retval = 0; /* return status */
 
@@ -403,6 +1045,48 @@ main (int argc, char** argv)
         opts++;
         break;
 
+      case 'O':
+        if (argc <= 2)
+          goto Usage;
+
+        if (!SetOutputDirectory (*++argv)) {
+          fprintf (stderr, "Could not open the output directory '%s': %s\n",
+                   *argv, strerror(errno));
+          return 2;
+        }
+        argc--;
+        break;
+      case 'T':
+        if (image || archive || catalog)
+          goto Usage;
+        listFile = listEntry;
+        break;
+      case 'S':
+        store = true;
+        /* fall through */
+      case 'J':
+        if (image || archive || listFile)
+          goto Usage;
+        catalog = true;
+        break;
+      case 's':
+        storedOrder = true;
+        break;
+      case 'j':
+        if (argc <= 2)
+          goto Usage;
+
+        {
+          char* end;
+          unsigned long n = strtoul (*++argv, &end, 10);
+          argc--;
+
+          if (*end || !n || n > 256)
+            goto Usage;
+
+          jobs = (unsigned) n;
+        }
+        break;
       case 'n':
         readFunc = ReadNative;
         break;
@@ -431,33 +1115,41 @@ main (int argc, char** argv)
         readFunc = ReadCpmImage;
         break;
       case 'I':
-        writeFunc = Write9660;
+        openFunc = Open9660;
         break;
       case 'P':
-        writeFunc = WritePC64;
+        openFunc = OpenPC64;
         break;
       case 'N':
-        writeFunc = WriteNative;
+        openFunc = OpenNative;
         break;
       case 'L':
-        if (image || archive || argc <= 2)
+        if (image || archive || listFile || catalog || argc <= 2)
           goto Usage;
 
-        archive = newArchive();
+        if (!(archive = newArchive())) {
+          fprintf (stderr, "Could not create a temporary file: %s\n",
+                   strerror(errno));
+          return 2;
+        }
         writeArchiveFunc = ArchiveLynx;
         archiveFilename = *++argv;argc--;
         break;
       case 'C':
-        if (image || archive || argc <= 2)
+        if (image || archive || listFile || catalog || argc <= 2)
           goto Usage;
 
-        archive = newArchive();
+        if (!(archive = newArchive())) {
+          fprintf (stderr, "Could not create a temporary file: %s\n",
+                   strerror(errno));
+          return 2;
+        }
         writeArchiveFunc = ArchiveC2N;
         archiveFilename = *++argv;argc--;
         break;
       case 'M':
       case 'D':
-        if (archive)
+        if (archive || listFile || catalog)
           goto Usage;
 
         if (argc > 2) {
@@ -477,7 +1169,7 @@ main (int argc, char** argv)
             goto Usage;
           }
 
-          writeFunc = 0;
+          openFunc = 0;
           writeImageFunc = *opts == 'M' ? WriteCpmImage : WriteImage;
 
           opts++;
@@ -522,6 +1214,10 @@ main (int argc, char** argv)
     fputs ("Options: -I: Create ISO 9660 compliant file names.\n"
            "         -P: Output files in PC64 format.\n"
            "         -N: Output files in native format.\n"
+           "         -O directory: Write the -I, -P, -N or -S files there.\n"
+           "         -T: List the files instead of converting them.\n"
+           "         -J: Write a JSON catalog of the files instead.\n"
+           "         -S: Like -J, also writing each distinct file as its SHA-1.\n"
            "         -L archive.lnx: Output files in Lynx format.\n"
            "         -C archive.c2n: Output files in Commodore C2N format.\n"
            "         -D4 imagefile: Write to a 1541 disk image.\n"
@@ -551,6 +1247,10 @@ main (int argc, char** argv)
            "         -d: input files in disk image format.\n"
            "         -m: input files in C128 CP/M disk image format.\n"
            "\n"
+           "         -s: Write T64 archive files in stored order, one at a time.\n"
+           "         -j jobs: Convert input files concurrently"
+           " (host files, -T or -J).\n"
+           "\n"
            "         -v2: Verbose mode.  Display all messages.\n"
            "         -v1: Display warnings in addition to errors.\n"
            "         -v0: Display error messages only.\n"
@@ -570,39 +1270,45 @@ main (int argc, char** argv)
     return 1;
   }
 
+  /* Files that are catalogued or written to the host file system
+     need not be copied. */
+  if (catalog) {
+    writeSegments = catalogFile;
+    locateFile = locateEntry;
+  }
+  else if (!image && !archive && openFunc && !listFile) {
+    writeSegments = writeFileSegments;
+    writeSink = &hostSink;
+  }
+
   /* Process the files. */
 
-  for (; --argc; argv++) {
-    enum RdStatus status;
-    currentFilename = *argv;
+#ifdef HAVE_PTHREAD
+  if (pthread_key_create (&currentInputKey, 0)) {
+    fputs ("pthread_key_create failed\n", stderr);
+    return 4;
+  }
 
-    if (!(file = fopen (currentFilename, "rb"))) {
-      fprintf (stderr, "fopen '%s': %s\n", currentFilename, strerror(errno));
-      retval = 2;
-      continue;
-    }
+  /* Files can be listed, catalogued or written to the host concurrently. */
+  if (jobs > 1 && (writeSegments || listFile)) {
+    retval = convertFiles (readFunc, argv, argc - 1);
+    if (retval > 2)
+      return retval;
+    argc = 1;
+  }
+#endif
 
-    status = (*readFunc) (file, *argv, writeFile, writeLog);
-    fclose (file);
+  for (; --argc; argv++) {
+    int status = convertFile (readFunc, *argv);
 
-    switch (status) {
-    case RdOK:
-      writeLog (Everything, 0, "Archive extracted.");
+    if (!status)
       continue;
 
-    case RdNoSpace:
-      writeLog (Errors, 0, "out of space.");
-      retval = 3;
-      goto read_error;
-
-    case RdFail:
-      break;
-    }
+    retval = status;
 
-    writeLog (Errors, 0, "unexpected error.");
-    retval = 4;
-  read_error:
-    if (image || archive)
+    if (status == 2)
+      continue;
+    else if (image || archive)
       goto write;
     else
       return retval;
@@ -613,7 +1319,9 @@ write:
     do {
       switch (CloseImage (image)) {
       case ImOK:
-        writeLog (Everything, 0, "Wrote image file \"%s\"", image->name);
+        writeLog (Everything, 0, "Wrote image file \"%s\" (%lu of %lu bytes)",
+                  image->name,
+                  (unsigned long) image->written, (unsigned long) image->size);
         continue;
 
       case ImNoSpace:
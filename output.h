@@ -38,26 +38,69 @@ enum WrStatus
   WrFail        /**<Generic failure */
 };
 
-/** Write a file in some format
+/** A contiguous part of the contents of a file */
+struct Segment
+{
+  /** the data */
+  const byte_t* data;
+  /** length of the data in bytes */
+  size_t length;
+};
+
+/** Create a file in some format, for writing its contents
  * @param name          native (PETSCII) name of the file
- * @param data          the contents of the file
- * @param length        length of the file contents
+ * @param file          (output) the file, positioned at its contents
  * @param newname       (output) the converted file name
  * @param log           Call-back function for diagnostic output
  * @return              status of the operation
  */
-typedef enum WrStatus write_t (const struct Filename* name,
-                               const byte_t* data,
-                               size_t length,
-                               char** newname,
-                               log_t log);
-
-/** Write a file in raw format */
-write_t WriteNative;
-/** Write a file in PC64 format (.P00, .S00 etc.) */
-write_t WritePC64;
-/** Write a file in raw format, using ISO 9660 compliant filenames */
-write_t Write9660;
+typedef enum WrStatus open_t (const struct Filename* name,
+                              FILE** file,
+                              char** newname,
+                              log_t log);
+
+/** Write the contents of a file to a stream created by an open_t function
+ * @param file          the output stream
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @return              true on success; false with errno set on failure
+ */
+bool
+WriteContents (FILE* file,
+               const struct Segment* segments,
+               size_t count);
+
+/** Set the directory where host files are written
+ * @param dir           the directory name
+ * @return              true on success; false with errno set on failure
+ */
+bool
+SetOutputDirectory (const char* dir);
+
+/** Create a file in raw format */
+open_t OpenNative;
+/** Create a file in PC64 format (.P00, .S00 etc.) */
+open_t OpenPC64;
+/** Create a file in raw format, using ISO 9660 compliant filenames */
+open_t Open9660;
+
+/** Write a file to a content-addressed store, unless it is there already
+ * @param key           the host file name, derived from the contents
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @param name          native (PETSCII) name of the file
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ *                      (WrFileExists if the contents were already stored)
+ */
+enum WrStatus
+WriteStore (const char* key,
+            const struct Segment* segments,
+            size_t count,
+            size_t length,
+            const struct Filename* name,
+            log_t log);
 
 /** Write a file to a disk image
  * @param name          native (PETSCII) name of the file
@@ -121,7 +164,8 @@ enum ArStatus
 };
 
 /** Allocate an archive data structure.
- * @return      a newly allocated empty archive structure
+ * @return      a newly allocated empty archive structure,
+ *              or NULL if the temporary file could not be created
  */
 struct Archive*
 newArchive (void);
@@ -147,6 +191,29 @@ WriteArchive (const struct Filename* name,
               struct Archive* archive,
               log_t log);
 
+/** Read the contents of the archive entries, in order.
+ * The first call after rewind (archive->data) reads the first entry.
+ * @param archive       the archive
+ * @param buf           (output) the contents, or NULL to skip them
+ * @param length        number of bytes to read
+ * @return              true if the contents were read
+ */
+bool
+readArchive (const struct Archive* archive,
+             byte_t* buf,
+             size_t length);
+
+/** Copy the contents of the archive entries to a file, in order.
+ * @param archive       the archive
+ * @param file          the destination file
+ * @param length        number of bytes to copy
+ * @return              true if the contents were copied
+ */
+bool
+copyArchive (const struct Archive* archive,
+             FILE* file,
+             size_t length);
+
 /** Write an archive to a file.
  * @param archive       the archive to be written
  * @param filename      host file name of the archive file
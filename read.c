@@ -49,6 +49,43 @@ ascii2petscii (unsigned char c)
   return c;
 }
 
+/** Copy the rest of an input file to writeSink in chunks
+ * @param file          the file input stream
+ * @param name          native (PETSCII) name of the file
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+static enum WrStatus
+streamFile (FILE* file,
+            const struct Filename* name,
+            log_t log)
+{
+  byte_t buf[BUFSIZ];
+  struct Sink* sink;
+  enum WrStatus closed, status = (*writeSink->open) (name, &sink);
+
+  if (status != WrOK)
+    return status;
+
+  for (;;) {
+    size_t length = fread (buf, 1, sizeof buf, file);
+
+    if (length && (*writeSink->write) (sink, buf, length) != WrOK)
+      break;
+
+    if (length < sizeof buf) {
+      if (ferror (file)) {
+        (*log) (Errors, 0, "fread: %s", strerror(errno));
+        status = WrFail;
+      }
+      break;
+    }
+  }
+
+  closed = (*writeSink->close) (sink);
+  return status == WrOK ? closed : status;
+}
+
 /** Read a file in the native format of the host system
  * @param file          the file input stream
  * @param filename      host system name of the file
@@ -166,20 +203,29 @@ ReadNative (FILE* file,
   if (fseek (file, 0, SEEK_SET))
     goto seekError;
 
-  if (i == 0);
-  else if (!(buf = malloc (i))) {
-    (*log) (Errors, 0, "Out of memory.");
-    return RdFail;
-  }
-  else if (1 != fread (buf, i, 1, file)) {
-    (*log) (Errors, 0, "fread: %s", strerror(errno));
-    free (buf);
-    return RdFail;
-  }
+  if (locateFile)
+    (*locateFile) (0, 0, 0);
 
-  status = (*writeCallback) (&name, buf ? buf : &dummy, i);
+  if (listFile)
+    status = (*listFile) (&name, i);
+  else if (writeSink)
+    status = streamFile (file, &name, log);
+  else {
+    if (i == 0);
+    else if (!(buf = malloc (i))) {
+      (*log) (Errors, 0, "Out of memory.");
+      return RdFail;
+    }
+    else if (1 != fread (buf, i, 1, file)) {
+      (*log) (Errors, 0, "fread: %s", strerror(errno));
+      free (buf);
+      return RdFail;
+    }
 
-  free (buf);
+    status = (*writeCallback) (&name, buf ? buf : &dummy, i);
+
+    free (buf);
+  }
 
   switch (status) {
   case WrOK:
@@ -209,7 +255,8 @@ ReadPC64 (FILE* file,
   struct Filename name;
   const char* suffix = 0;
   unsigned i;
-  byte_t* buf;
+  byte_t header[26];
+  byte_t* buf = 0;
   enum WrStatus status;
 
   /* Determine file type. */
@@ -254,37 +301,49 @@ ReadPC64 (FILE* file,
   if (fseek (file, 0, SEEK_SET))
     goto seekError;
 
-  if (i < 26) {
+  if (i < sizeof header) {
     (*log) (Errors, 0, "short file");
     return RdFail;
   }
 
-  if (!(buf = malloc (i))) {
-    (*log) (Errors, 0, "Out of memory.");
-    return RdFail;
-  }
-
-  /* Read the file. */
+  /* Read and check the file header. */
 
-  if (1 != fread (buf, i, 1, file)) {
+  if (1 != fread (header, sizeof header, 1, file)) {
     (*log) (Errors, 0, "fread: %s", strerror(errno));
-  ReadFail:
-    free (buf);
     return RdFail;
   }
 
-  /* Check the file header. */
-
-  if (memcmp (buf, "C64File", 8)) {
+  if (memcmp (header, "C64File", 8)) {
     (*log) (Errors, 0, "Invalid PC64 header");
-    goto ReadFail;
+    return RdFail;
   }
 
-  memcpy (name.name, &buf[8], 16);
-  name.recordLength = buf[25];
+  memcpy (name.name, &header[8], 16);
+  name.recordLength = header[25];
+  i -= sizeof header;
+
+  if (locateFile)
+    (*locateFile) ((long) sizeof header, 0, 0);
+
+  if (listFile)
+    status = (*listFile) (&name, i);
+  else if (writeSink)
+    status = streamFile (file, &name, log);
+  else {
+    if (i == 0);
+    else if (!(buf = malloc (i))) {
+      (*log) (Errors, 0, "Out of memory.");
+      return RdFail;
+    }
+    else if (1 != fread (buf, i, 1, file)) {
+      (*log) (Errors, 0, "fread: %s", strerror(errno));
+      free (buf);
+      return RdFail;
+    }
 
-  status = (*writeCallback) (&name, &buf[26], i - 26);
-  free (buf);
+    status = (*writeCallback) (&name, buf ? buf : header, i);
+    free (buf);
+  }
 
   switch (status) {
   case WrOK:
@@ -20,6 +20,13 @@ ENDMACRO()
 MACRO(CBMCONVERT)
   EXECUTE_PROGRAM(${CBMCONVERT} ${ARGV})
 ENDMACRO()
+MACRO(LIST_FILES expected)
+  EXECUTE_PROCESS(COMMAND ${CBMCONVERT} ${ARGN}
+    OUTPUT_VARIABLE list RESULT_VARIABLE res)
+  IF (res OR NOT list STREQUAL "${expected}")
+    MESSAGE(FATAL_ERROR "${ARGN} failed: ${res}\n${list}")
+  ENDIF()
+ENDMACRO()
 
 FILE(REMOVE 123.d64 123.d71 123.d81 124.d64)
 FILE(REMOVE 123.lnx 123.c2n 5.d64 5.lnx 5.l7f 5.rel)
@@ -36,6 +43,12 @@ FILE(WRITE 5.l7F "${b}: ;")
 
 CBMCONVERT(-D4 123.d64 1,S 2,U 3,D 4,P 5.l7F)
 MD5SUM(5d7682a959ce78c07e7a6ac24bfd4799 123.d64)
+LIST_FILES("{\"container\":\"1,S\",\
+\"offset\":0,\"track\":null,\"sector\":null,\"name\":\"31a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0\",\
+\"text\":\"1,seq\",\"type\":\"seq\",\"record_length\":0,\"length\":1,\
+\"crc32\":\"83dcefb7\",\"sha1\":\"356a192b7913b04c54574d18c28d46e6395428ab\"}\n"
+  -J 1,S)
+EXECUTE_PROGRAM_EXPECT(1 ${CBMCONVERT} -J -T 1,S)
 
 EXECUTE_PROGRAM_EXPECT(1 ${CBMCONVERT} -D 123.d64 5.l7F)
 CBMCONVERT(-D4o 123.d64 5.l7F)
@@ -44,6 +57,8 @@ CBMCONVERT(-L 123.lnx -d 123.d64)
 MD5SUM(99c30961746ece8de28cd524511162bf 123.lnx)
 CBMCONVERT(-vv -C 123.c2n -d 123.d64)
 MD5SUM(cc439f7db11441055aac1439494883fd 123.c2n)
+LIST_FILES("123.c2n\t1,seq\t191\n123.c2n\t2,seq\t191\n123.c2n\t3,seq\t191\n\
+123.c2n\t4,prg\t254\n123.c2n\t5,seq\t382\n" -T -c 123.c2n)
 
 EXECUTE_PROGRAM_EXPECT(4 ${CBMCONVERT} -D4 123.d64 -c 123.c2n)
 MD5SUM(5d7682a959ce78c07e7a6ac24bfd4799 123.d64)
@@ -63,7 +78,67 @@ CBMCONVERT(-L 123.lnx -o1 -n 4,p 4,p)
 MD5SUM(31036a537e19832da30b21e630867606 123.lnx)
 CBMCONVERT(-L 123.lnx -n 1,s 2,u 3,d 4,p 5.l7f)
 MD5SUM(99c30961746ece8de28cd524511162bf 123.lnx)
+LIST_FILES("123.lnx\t1,seq\t1\n123.lnx\t2,usr\t2\n123.lnx\t3,del\t3\n\
+123.lnx\t4,prg\t254\n123.lnx\t5,l7F\t254\n" -T -l 123.lnx)
 CBMCONVERT(-D4o 123.d64 -l 123.lnx)
+LIST_FILES("123.d64\t1,seq\t1\n123.d64\t2,usr\t2\n123.d64\t3,del\t3\n\
+123.d64\t4,prg\t254\n123.d64\t5,l7F\t254\n" -T -d 123.d64)
+EXECUTE_PROGRAM_EXPECT(1 ${CBMCONVERT} -T -D4 4.d64 -d 123.d64)
+FILE(REMOVE_RECURSE store)
+FILE(MAKE_DIRECTORY store)
+CBMCONVERT(-S -O store -d 123.d64)
+CBMCONVERT(-S -O store 1,s 2,u 3,d 4,p)
+FILE(GLOB stored RELATIVE ${CMAKE_CURRENT_BINARY_DIR}/store store/*)
+LIST(LENGTH stored n)
+IF (NOT n EQUAL 5)
+  MESSAGE(FATAL_ERROR "unexpected store contents: ${stored}")
+ENDIF()
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files 1,s
+  store/356a192b7913b04c54574d18c28d46e6395428ab)
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files 3,d
+  store/40bd001563085fc35165329ea1ff5c5ecbdbbeef)
+# A truncated entry must be replaced.
+FILE(WRITE store/40bd001563085fc35165329ea1ff5c5ecbdbbeef "1")
+CBMCONVERT(-S -O store 3,d)
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files 3,d
+  store/40bd001563085fc35165329ea1ff5c5ecbdbbeef)
+FILE(GLOB stored RELATIVE ${CMAKE_CURRENT_BINARY_DIR}/store store/*)
+LIST(LENGTH stored n)
+IF (NOT n EQUAL 5)
+  MESSAGE(FATAL_ERROR "unexpected store contents: ${stored}")
+ENDIF()
+# A temporary file of an interrupted run must be removed.
+FILE(REMOVE store/40bd001563085fc35165329ea1ff5c5ecbdbbeef)
+FILE(WRITE store/40bd001563085fc35165329ea1ff5c5ecbdbbeef.t00 "1")
+CBMCONVERT(-S -O store 3,d)
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files 3,d
+  store/40bd001563085fc35165329ea1ff5c5ecbdbbeef)
+FILE(GLOB stored RELATIVE ${CMAKE_CURRENT_BINARY_DIR}/store store/*)
+LIST(LENGTH stored n)
+IF (NOT n EQUAL 5)
+  MESSAGE(FATAL_ERROR "unexpected store contents: ${stored}")
+ENDIF()
+FILE(REMOVE_RECURSE store)
+# -O writes the host files to another directory, numbering duplicates.
+FILE(REMOVE_RECURSE out)
+FILE(MAKE_DIRECTORY out)
+FOREACH(format -N -P -I)
+  CBMCONVERT(${format} -O out 4,p)
+  CBMCONVERT(${format} -O out 4,p)
+ENDFOREACH()
+FOREACH(name 4.prg 4~0.prg 4.000 4.001)
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files 4,p out/${name})
+ENDFOREACH()
+MD5SUM(bfd9329a6de5030771240bfe3305c89b out/4.p00)
+MD5SUM(bfd9329a6de5030771240bfe3305c89b out/4.p01)
+FILE(GLOB stored RELATIVE ${CMAKE_CURRENT_BINARY_DIR}/out out/*)
+LIST(LENGTH stored n)
+IF (NOT n EQUAL 6 OR EXISTS 4.prg OR EXISTS 4.p00)
+  MESSAGE(FATAL_ERROR "unexpected output: ${stored}")
+ENDIF()
+FILE(REMOVE_RECURSE out)
+EXECUTE_PROGRAM_EXPECT(2 ${CBMCONVERT} -N -O out 4,p)
+EXECUTE_PROGRAM_EXPECT(2 ${CBMCONVERT} -N -O 4,p 4,p)
 EXECUTE_PROGRAM_EXPECT(4 ${CBMCONVERT} -D4 123.d64 -l 123.lnx)
 MD5SUM(5d7682a959ce78c07e7a6ac24bfd4799 123.d64)
 CBMCONVERT(-D4o 123.d64 5.l7f)
@@ -252,3 +327,50 @@ STRING(ASCII 1 1 4 2 4 x)
 FILE(WRITE foo.c2n "${x}${r2}")
 EXECUTE_PROGRAM_EXPECT(4 ${CBMCONVERT} -D4 foo.d64 -c foo.c2n)
 FILE(REMOVE foo.c2n foo.d64)
+
+# ${T64_FILES} is a T64 archive with 3 directory entries:
+# first,prg at offset 222, with an end address 100 bytes after $0801,
+# overlapping second,prg, which starts at offset 192 with 30 bytes, and
+# third,seq at offset 262, claiming 50 bytes but truncated to 20.
+STRING(ASCII 1 8 a)
+FILE(WRITE first.expected
+  "${a}AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA")
+STRING(ASCII 1 16 a)
+FILE(WRITE second.expected "${a}BBBBBBBBBBBBBBBBBBBBBBBBBBBBBB")
+STRING(ASCII 1 192 a)
+FILE(WRITE third.expected "${a}CCCCCCCCCCCCCCCCCCCC")
+FILE(REMOVE first.prg second.prg third.seq)
+LIST_FILES("${T64_FILES}\tfirst,prg\t42\n${T64_FILES}\tsecond,prg\t32\n\
+${T64_FILES}\tthird,seq\t22\n" -T -t ${T64_FILES})
+LIST_FILES("${T64_FILES}\tsecond,prg\t32\n${T64_FILES}\tfirst,prg\t42\n\
+${T64_FILES}\tthird,seq\t22\n" -s -T -t ${T64_FILES})
+FOREACH(s "" -s)
+  CBMCONVERT(${s} -N -t ${T64_FILES})
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files first.prg first.expected)
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files second.prg second.expected)
+  EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files third.seq third.expected)
+  FILE(REMOVE first.prg second.prg third.seq)
+ENDFOREACH()
+FILE(REMOVE first.expected second.expected third.expected)
+
+# ${ARK_FILES} is an Arkive archive of relative,l7F (242 records of
+# 127 bytes in 121 blocks and 2 side sectors, of which only the last one
+# is stored) and program,prg (354 bytes).
+SET(dots "................................................................")
+SET(r "")
+FOREACH(i RANGE 1 242)
+  STRING(SUBSTRING "record ${i}${dots}${dots}" 0 127 record)
+  SET(r "${r}${record}")
+ENDFOREACH()
+FILE(WRITE relative.expected "${r}")
+SET(p "PPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPP")
+STRING(ASCII 1 8 a)
+FILE(WRITE program.expected "${a}${p}${p}${p}${p}${p}${p}${p}${p}${p}${p}${p}")
+FILE(REMOVE relative.l7F program.prg)
+LIST_FILES("${ARK_FILES}\trelative,l7F\t30734\n\
+${ARK_FILES}\tprogram,prg\t354\n" -T -k ${ARK_FILES})
+CBMCONVERT(-N -k ${ARK_FILES})
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files
+  relative.l7F relative.expected)
+EXECUTE_PROGRAM(${CMAKE_COMMAND} -E compare_files program.prg program.expected)
+FILE(REMOVE relative.l7F program.prg relative.expected program.expected)
@@ -82,22 +82,90 @@ struct t64entry
   byte_t name[16];
 };
 
+/** A file in a T64 archive */
+struct T64File
+{
+  /** the file name and type */
+  struct Filename name;
+  /** the start address, least significant byte first */
+  byte_t startAddr[2];
+  /** position of the contents in the archive */
+  long fileoffset;
+  /** length of the contents, excluding the start address */
+  size_t length;
+  /** the start address and the contents that were read */
+  byte_t* buf;
+  /** number of bytes in buf */
+  size_t readlength;
+};
+
+/** Compare T64 files by their position in the archive
+ * @param a     pointer to the first file
+ * @param b     pointer to the second file
+ * @return      negative, 0 or positive if a is before, at or after b
+ */
+static int
+compareOffsets (const void* a, const void* b)
+{
+  const struct T64File* f = *(const struct T64File* const*) a;
+  const struct T64File* g = *(const struct T64File* const*) b;
+
+  if (f->fileoffset != g->fileoffset)
+    return f->fileoffset < g->fileoffset ? -1 : 1;
+
+  /* keep the directory order of files at the same position */
+  return f < g ? -1 : f > g;
+}
+
+/** Write or list a file of a T64 archive
+ * @param f             the file
+ * @param writeCallback function for writing the contained files
+ * @return              status of the operation
+ */
+static enum RdStatus
+writeT64File (const struct T64File* f, write_file_t writeCallback)
+{
+  if (locateFile)
+    (*locateFile) (f->fileoffset, 0, 0);
+
+  switch (listFile
+          ? (*listFile) (&f->name, f->readlength)
+          : (*writeCallback) (&f->name, f->buf, f->readlength)) {
+  case WrOK:
+    return RdOK;
+  case WrNoSpace:
+    return RdNoSpace;
+  case WrFail:
+  case WrFileExists:
+    break;
+  }
+
+  return RdFail;
+}
+
 /** Read and convert a tape archive of the C64S emulator
  * @param file          the file input stream
- * @param filename      host system name of the file
  * @param writeCallback function for writing the contained files
  * @param log           Call-back function for diagnostic output
+ * @param arena         memory arena for the file contents
  * @return              status of the operation
  */
-enum RdStatus
-ReadT64 (FILE* file,
-         const char* filename,
+static enum RdStatus
+readT64 (FILE* file,
          write_file_t writeCallback,
-         log_t log)
+         log_t log,
+         struct Arena* arena)
 {
-  unsigned numEntries, entry;
-
-  (void) filename; /* unused */
+  unsigned numEntries, count, entry, next;
+  enum RdStatus status;
+  /** current position in the archive, or -1 if unknown */
+  long pos;
+  /** end of the archive (only determined for listing) */
+  long end = 0;
+  /** the files, in directory order */
+  struct T64File* files;
+  /** the files, in the order of their contents */
+  struct T64File** order;
 
   /* Check the header. */
 
@@ -145,104 +213,185 @@ ReadT64 (FILE* file,
             numEntries, maxEntries);
   }
 
-  /* Process the files */
+  if (!(files = arenaAlloc (arena, numEntries * sizeof *files)) ||
+      !(order = arenaAlloc (arena, numEntries * sizeof *order))) {
+  memFail:
+    (*log) (Errors, 0, "Out of memory.");
+    return RdFail;
+  }
+
+  /* Read the directory, which follows the header, with one call. */
+  {
+    struct t64entry* dir = arenaAlloc (arena, numEntries * sizeof *dir);
+
+    if (!dir)
+      goto memFail;
+
+    count = (unsigned) fread (dir, sizeof *dir, numEntries, file);
+    pos = count < numEntries
+      ? -1 : (long) (sizeof (struct t64header) + numEntries * sizeof *dir);
+
+    for (entry = 0; entry < count; entry++) {
+      const struct t64entry* t64entry = &dir[entry];
+      struct T64File* f = order[entry] = &files[entry];
+      struct Filename* name = &f->name;
+
+      f->buf = 0;
+      name->type = PRG;
+      name->recordLength = 0;
+
+      /* Convert the header. */
+      memcpy (name->name, t64entry->name, 16);
+      {
+        int i;
+        /* Convert trailing spaces to shifted spaces. */
+        for (i = 16; --i && name->name[i] == ' '; name->name[i] = 0xA0);
+      }
+      f->fileoffset =
+        (long) t64entry->fileOffsetLowest |
+        t64entry->fileOffsetLower << 8 |
+        t64entry->fileOffsetHigher << 16 |
+        t64entry->fileOffsetHighest << 24;
+
+      f->startAddr[0] = t64entry->startAddrLow;
+      f->startAddr[1] = t64entry->startAddrHigh;
+      f->length =
+        ((t64entry->endAddrLow | (size_t) t64entry->endAddrHigh << 8) -
+         (t64entry->startAddrLow | (size_t) t64entry->startAddrHigh << 8)) &
+        0xFFFF;
+
+      if (t64entry->entryType != 1) {
+      unknown:
+        (*log) (Errors, name,
+                "Unknown entry type 0x%02x 0x%02x, assuming PRG",
+                t64entry->entryType, t64entry->fileType);
+      }
+      else if (t64entry->fileType != 1) {
+        unsigned filetype = t64entry->fileType & 0x8F;
+        if (filetype >= DEL && filetype <= USR)
+          name->type = (enum Filetype) filetype;
+        else
+          goto unknown;
+      }
+    }
+
+    arenaFree (arena, dir);
+  }
 
-  for (entry = 0; entry < numEntries; entry++) {
-    struct t64entry t64entry;
-    struct Filename name;
-    long fileoffset;
-    size_t length;
+  /* Read the files in the order of their contents, so that the archive
+     is read sequentially.  Many archives specify a bogus end address;
+     do not let a file extend to the contents of the next one.
+     When listing, only the lengths are needed.  Unless the files are
+     to be written in the same order, all of them are kept in memory
+     until they can be written in directory order. */
 
-    name.type = PRG;
-    name.recordLength = 0;
+  qsort (order, count, sizeof *order, compareOffsets);
 
-    if (fseek (file,
-               (long) (entry * sizeof t64entry + sizeof (struct t64header)),
-               SEEK_SET)) {
-      (*log) (Errors, 0, "fseek: %s", strerror (errno));
-      return RdFail;
-    }
+  if (listFile && count &&
+      (fseek (file, 0, SEEK_END) || (end = ftell (file)) < 0)) {
+    (*log) (Errors, 0, "fseek: %s", strerror(errno));
+    return RdFail;
+  }
 
-    if (1 != fread (&t64entry, sizeof t64entry, 1, file))
-      goto freadFail;
+  for (entry = next = 0; entry < count; entry++) {
+    struct T64File* f = order[entry];
 
-    /* Convert the header. */
-    memcpy (name.name, t64entry.name, 16);
-    {
-      int i;
-      /* Convert trailing spaces to shifted spaces. */
-      for (i = 16; --i && name.name[i] == ' '; name.name[i] = 0xA0);
-    }
-    fileoffset =
-      (long) t64entry.fileOffsetLowest |
-      t64entry.fileOffsetLower << 8 |
-      t64entry.fileOffsetHigher << 16 |
-      t64entry.fileOffsetHighest << 24;
-
-    length =
-      ((t64entry.endAddrLow | (size_t) t64entry.endAddrHigh << 8) -
-       (t64entry.startAddrLow | (size_t) t64entry.startAddrHigh << 8)) &
-      0xFFFF;
-
-    if (t64entry.entryType != 1) {
-    unknown:
-      (*log) (Errors, &name,
-              "Unknown entry type 0x%02x 0x%02x, assuming PRG",
-              t64entry.entryType, t64entry.fileType);
+    /* Find the next file that starts after this one. */
+    while (next < count && order[next]->fileoffset <= f->fileoffset)
+      next++;
+
+    if (next < count &&
+        (unsigned long) (order[next]->fileoffset - f->fileoffset) <
+        f->length) {
+      f->length = (size_t) (order[next]->fileoffset - f->fileoffset);
+      (*log) (Warnings, &f->name,
+              "Overlapping the next file, truncated to %zu bytes",
+              f->length);
     }
-    else if (t64entry.fileType != 1) {
-      unsigned filetype = t64entry.fileType & 0x8F;
-      if (filetype >= DEL && filetype <= USR)
-        name.type = (enum Filetype) filetype;
+
+    if (listFile) {
+      if (f->fileoffset < 0 || f->fileoffset >= end)
+        f->readlength = 0;
+      else if ((unsigned long) (end - f->fileoffset) < f->length)
+        f->readlength = (size_t) (end - f->fileoffset);
       else
-        goto unknown;
-    }
+        f->readlength = f->length;
 
-    /* Read the file */
-    {
-      byte_t* buf;
-      enum WrStatus status;
-      size_t readlength;
+      if (f->readlength != f->length)
+        (*log) (Warnings, &f->name, "Truncated file, proceeding anyway");
 
-      if (!(buf = malloc (length + 2))) {
-        (*log) (Errors, &name, "Out of memory.");
-        return RdFail;
-      }
+      f->readlength += 2;
+      goto readDone;
+    }
 
-      buf[0] = t64entry.startAddrLow;
-      buf[1] = t64entry.startAddrHigh;
+    if (!(f->buf = arenaAlloc (arena, f->length + 2))) {
+      (*log) (Errors, &f->name, "Out of memory.");
+      return RdFail;
+    }
 
-      if (fseek (file, fileoffset, SEEK_SET)) {
-        (*log) (Errors, &name, "fseek: %s", strerror(errno));
-      ReadFail:
-        free (buf);
-        return RdFail;
-      }
+    f->buf[0] = f->startAddr[0];
+    f->buf[1] = f->startAddr[1];
 
-      if (length != (readlength = fread (&buf[2], 1, length, file))) {
-        if (feof (file))
-          (*log) (Warnings, &name, "Truncated file, proceeding anyway");
-        if (ferror (file)) {
-          (*log) (Errors, &name, "fread: %s", strerror(errno));
-          goto ReadFail;
-        }
-      }
+    if (pos != f->fileoffset && fseek (file, f->fileoffset, SEEK_SET)) {
+      (*log) (Errors, &f->name, "fseek: %s", strerror(errno));
+      return RdFail;
+    }
 
-      status = (*writeCallback) (&name, buf, readlength + 2);
-      free (buf);
-
-      switch (status) {
-      case WrOK:
-        continue;
-      case WrNoSpace:
-        return RdNoSpace;
-      case WrFail:
-      case WrFileExists:
-        break;
+    if (f->length != (f->readlength = fread (&f->buf[2], 1, f->length,
+                                             file))) {
+      if (feof (file))
+        (*log) (Warnings, &f->name, "Truncated file, proceeding anyway");
+      if (ferror (file)) {
+        (*log) (Errors, &f->name, "fread: %s", strerror(errno));
+        return RdFail;
       }
-      return RdFail;
+      pos = -1; /* seek before the next read, to reset the EOF flag */
+    }
+    else
+      pos = f->fileoffset + (long) f->length;
+
+    f->readlength += 2;
+
+  readDone:
+    if (storedOrder) {
+      status = writeT64File (f, writeCallback);
+      arenaFree (arena, f->buf);
+      f->buf = 0;
+      if (status != RdOK)
+        return status;
     }
   }
 
+  /* Write the files in directory order. */
+
+  for (entry = 0; !storedOrder && entry < count; entry++)
+    if ((status = writeT64File (&files[entry], writeCallback)) != RdOK)
+      return status;
+
+  if (count < numEntries)
+    goto freadFail;
+
   return RdOK;
 }
+
+/** Read and convert a tape archive of the C64S emulator
+ * @param file          the file input stream
+ * @param filename      host system name of the file
+ * @param writeCallback function for writing the contained files
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+enum RdStatus
+ReadT64 (FILE* file,
+         const char* filename,
+         write_file_t writeCallback,
+         log_t log)
+{
+  struct Arena arena = { 0 };
+  enum RdStatus status = readT64 (file, writeCallback, log, &arena);
+
+  (void) filename; /* unused */
+
+  arenaRelease (&arena);
+  return status;
+}
@@ -20,34 +20,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <setjmp.h>
 
 #include "input.h"
 
-/** I/O status. 0=ok, or EOF */
-static int Status;
-/** Current offset from ARC or SDA file's beginning */
-static long FilePos;
-/** Current archive */
-static FILE* fp;
-/** Bit Buffer */
-static unsigned int BitBuf;
-/** checksum */
-static unsigned int  crc;
-/** used in checksum calculation */
-static unsigned char crc2;
-/** Huffman codes */
-static unsigned long hc[257];
-/** Lengths of huffman codes */
-static unsigned char hl[257];
-/** Character associated with Huffman code */
-static unsigned char hv[257];
-/** Number of Huffman codes */
-static int hcount;
-/** Run-Length control character */
-static unsigned int  ctrl;
-
 /** C64 Archive entry header */
 struct entry
 {
@@ -74,9 +52,6 @@ struct entry
   unsigned char rl;
 };
 
-/** Current C64 Archive entry header */
-static struct entry entry;
-
 /** Lempel Zev compression string table entry */
 struct lz
 {
@@ -84,9 +59,6 @@ struct lz
   byte_t ext;           /**< Extension character */
 };
 
-/** Lempel Zev compression string table */
-static struct lz lztab[4096];
-
 /** Lempel Zev stack handling error codes */
 enum LZStackErrorType
 {
@@ -94,288 +66,551 @@ enum LZStackErrorType
   PopError              /**< Stack underflow (out of data) */
 };
 
-/** Lempel Zev exception handling structure */
-static jmp_buf LZStackError;
-
-/** Lempel Zev stack */
-static byte_t stack[512];
-
-/** Set to 0 to reset un-crunch */
-static int State = 0;
-/** Lempel Zev stack pointer */
-static unsigned lzstack = 0;
-/** Current code size */
-static int cdlen;
-/** Last received code */
-static unsigned code;
-/** Bump cdlen when code reaches this value */
-static int wtcl;
-/** Copy of wtcl */
-static int wttcl;
+/** Huffman decoding table entry types */
+enum HuffType
+{
+  HuffError,            /**< Invalid code */
+  HuffByte,             /**< Decoded byte */
+  HuffTable             /**< Sub-table for longer codes */
+};
+
+/** Huffman decoding table entry */
+struct Huff
+{
+  unsigned short value; /**< Decoded byte, or offset of the sub-table */
+  byte_t length;        /**< Code length, or number of sub-table index bits */
+  byte_t type;          /**< Entry type (enum HuffType) */
+};
+
+/** Maximum length of a Huffman code that can be decoded */
+#define HUFFMAX 23
+/** Number of index bits in the first-level Huffman decoding table */
+#define HUFFROOT 10
+/** Maximum number of index bits in a Huffman decoding sub-table */
+#define HUFFSUB 7
+/** Maximum size of the Huffman decoding tables: a first-level table,
+    and at most 256 second-level and 256 third-level sub-tables */
+#define HUFFSIZE ((1 << HUFFROOT) + (256 << HUFFSUB) + \
+                  (256 << (HUFFMAX - HUFFROOT - HUFFSUB)))
+
+/** Number of bits in the bit accumulator */
+#define ACCBITS (CHAR_BIT * sizeof (unsigned long))
+/** BitEnd value when the end of the archive has not been reached */
+#define NOBITEND UINT_MAX
+/** Maximum size of an archived file (only three bytes are stored) */
+#define ARCMAXSIZE 0xffffffUL
+
+/** ARC/SDA decoder state */
+struct Arc
+{
+  /** Lempel Zev exception handling structure */
+  jmp_buf LZStackError;
+  /** Contents of the archive */
+  byte_t* data;
+  /** Length of the archive in bytes */
+  size_t size;
+  /** Offset of the next byte to be read from data */
+  size_t pos;
+  /** Flag: a byte was read past the end of the archive (like feof()) */
+  bool eof;
+  /** I/O status. 0=ok, or EOF */
+  int Status;
+  /** Current offset from ARC or SDA file's beginning */
+  size_t FilePos;
+  /** Bit accumulator, least significant bit first */
+  unsigned long BitBuf;
+  /** Number of valid bits in BitBuf */
+  unsigned BitCount;
+  /** Number of bits in BitBuf that precede the end of the input,
+      or NOBITEND */
+  unsigned BitEnd;
+  /** checksum */
+  unsigned int crc;
+  /** used in checksum calculation */
+  unsigned char crc2;
+  /** Huffman codes */
+  unsigned long hc[257];
+  /** Lengths of huffman codes */
+  unsigned char hl[257];
+  /** Character associated with Huffman code */
+  unsigned char hv[257];
+  /** Number of Huffman codes */
+  int hcount;
+  /** Huffman decoding tables */
+  struct Huff huff[HUFFSIZE];
+  /** Number of used entries in huff */
+  unsigned huffSize;
+  /** Run-Length control character */
+  unsigned int ctrl;
+  /** Current C64 Archive entry header */
+  struct entry entry;
+  /** Lempel Zev compression string table */
+  struct lz lztab[4096];
+  /** Lempel Zev stack */
+  byte_t stack[512];
+  /** Set to 0 to reset un-crunch */
+  int State;
+  /** Lempel Zev stack pointer */
+  unsigned lzstack;
+  /** Current code size */
+  int cdlen;
+  /** Last received code */
+  unsigned code;
+  /** Bump cdlen when code reaches this value */
+  int wtcl;
+  /** Copy of wtcl */
+  int wttcl;
+  /** Previous LZ code */
+  unsigned oldcode;
+  /** Current LZ code */
+  unsigned incode;
+  /** Last un-crunched byte */
+  byte_t kay;
+  /** Prefix of the next string table entry */
+  unsigned omega;
+  /** First byte of the last decoded string */
+  unsigned char finchar;
+  /** Current # of codes in table */
+  unsigned ncodes;
+  /** Output buffer of the current entry */
+  byte_t* buffer;
+  /** Allocated size of the output buffer */
+  size_t bufSize;
+};
 
 /** Shell Sort algorithm
  * from "C Programmer's Library" by Purdum, Leslie and Stegemoller
+ * @param arc   the decoder state
  */
 static void
-ssort (void)
+ssort (struct Arc* arc)
 {
   size_t m;
   size_t h,i,j,k;
 
-  m = sizeof hl;
+  m = sizeof arc->hl;
 
   while (m >>= 1) {
-    k = (sizeof hl) - m;
+    k = (sizeof arc->hl) - m;
     j = 1;
     do {
       i = j;
       do {
         h = i + m;
-        if (hl[h - 1] > hl[i - 1]) {
+        if (arc->hl[h - 1] > arc->hl[i - 1]) {
           unsigned long t;
           unsigned char u;
-          t = hc[i - 1], hc[i - 1] = hc[h - 1], hc[h - 1] = t;
-          u = hv[i - 1], hv[i - 1] = hv[h - 1], hv[h - 1] = u;
-          u = hl[i - 1], hl[i - 1] = hl[h - 1], hl[h - 1] = u;
-          i -= m;
+          t = arc->hc[i - 1], arc->hc[i - 1] = arc->hc[h - 1], arc->hc[h - 1] = t;
+          u = arc->hv[i - 1], arc->hv[i - 1] = arc->hv[h - 1], arc->hv[h - 1] = u;
+          u = arc->hl[i - 1], arc->hl[i - 1] = arc->hl[h - 1], arc->hl[h - 1] = u;
         }
         else
           break;
-      } while (i >= 1);
+      } while (i > m && (i -= m));
       j += 1;
     } while(j <= k);
   }
 }
 
+/** Move to a position in the archive
+ * @param arc   the decoder state
+ * @param pos   the offset from the beginning of the archive
+ */
+static void
+SeekArc (struct Arc* arc, size_t pos)
+{
+  arc->pos = pos;
+  arc->eof = false;
+}
+
+/** Read a byte from the archive, like fgetc() would
+ * @param arc   the decoder state
+ * @return      the byte, or EOF at the end of the archive
+ */
+static int
+NextByte (struct Arc* arc)
+{
+  if (arc->pos < arc->size)
+    return arc->data[arc->pos++];
+
+  arc->eof = true;
+  return EOF;
+}
+
 /** Receive a byte (eight bits) from the input
+ * @param arc   the decoder state
  * @return      the received byte
  */
 static byte_t
-GetByte (void)
+GetByte (struct Arc* arc)
 {
-  if (Status == EOF)
+  if (arc->Status == EOF)
     return 0;
 
-  if (feof (fp) || ferror (fp)) {
-    Status = EOF;
+  if (arc->eof) {
+    arc->Status = EOF;
     return 0;
   }
   else
-    Status = 0;
+    arc->Status = 0;
 
-  return (unsigned char) (fgetc (fp) & 0xff);
+  return (unsigned char) (NextByte (arc) & 0xff);
 }
 
 /** Receive a word (sixteen bits) from the input
+ * @param arc   the decoder state
  * @return      the received word
  */
 static word_t
-GetWord (void)
+GetWord (struct Arc* arc)
 {
   word_t u = 0;
 
-  if (Status == EOF)
+  if (arc->Status == EOF)
     return 0;
 
-  if (feof (fp) || ferror (fp)) {
-    Status = EOF;
+  if (arc->eof) {
+    arc->Status = EOF;
     return 0;
   }
   else {
-    Status = 0;
+    arc->Status = 0;
   }
 
-  u = (word_t) fgetc (fp) & 0xff;
-  u |= ((word_t) fgetc (fp) & 0xff) << 8;
+  u = (word_t) NextByte (arc) & 0xff;
+  u |= ((word_t) NextByte (arc) & 0xff) << 8;
 
   return u;
 }
 
 /** Receive a three-byte integer (twenty-four bits) from the input
+ * @param arc   the decoder state
  * @return      the received integer
  */
 static tbyte_t
-GetThree (void)
+GetThree (struct Arc* arc)
 {
   tbyte_t u = 0;
 
-  if (Status == EOF || feof (fp) || ferror (fp)) {
-    Status = EOF;
+  if (arc->Status == EOF || arc->eof) {
+    arc->Status = EOF;
     return 0;
   }
   else
-    Status = 0;
+    arc->Status = 0;
 
-  u = (tbyte_t) (fgetc (fp) & 0xff);
-  u |= ((tbyte_t) fgetc (fp) & 0xff) << 8;
-  u |= ((tbyte_t) fgetc (fp) & 0xff) << 16;
+  u = (tbyte_t) (NextByte (arc) & 0xff);
+  u |= ((tbyte_t) NextByte (arc) & 0xff) << 8;
+  u |= ((tbyte_t) NextByte (arc) & 0xff) << 16;
 
   return u;
 }
 
-/** Receive a bit from the input
- * @return      the received bit
+/** Empty the bit accumulator
+ * @param arc   the decoder state
  */
-static unsigned
-GetBit (void)
+static void
+ClearBits (struct Arc* arc)
+{
+  arc->BitBuf = 0;
+  arc->BitCount = 0;
+  arc->BitEnd = NOBITEND;
+}
+
+/** Fill the bit accumulator
+ * @param arc   the decoder state
+ * @param count minimum number of bits needed (at most 25)
+ */
+static void
+FillBits (struct Arc* arc, unsigned count)
 {
-  unsigned result = BitBuf >>= 1;
+  while (arc->BitCount <= ACCBITS - 8 && arc->pos < arc->size) {
+    arc->BitBuf |= (unsigned long) arc->data[arc->pos++] << arc->BitCount;
+    arc->BitCount += 8;
+  }
 
-  if (result == 1)
-    return 1 & (BitBuf = GetByte() | 0x0100U);
-  else
-    return 1 & result;
+  /* Past the end of the archive, GetByte() would return 0xff (from
+     fgetc() returning EOF), and then zero bytes while setting Status. */
+  while (arc->BitCount < count) {
+    if (!arc->eof) {
+      arc->eof = true;
+      arc->BitBuf |= 0xffUL << arc->BitCount;
+    }
+    else if (arc->BitEnd > arc->BitCount)
+      arc->BitEnd = arc->BitCount;
+    arc->BitCount += 8;
+  }
 }
 
-/** Fetch a Huffman code and convert it to what it represents
- * @return      the converted code
+/** Consume bits from the bit accumulator
+ * @param arc   the decoder state
+ * @param count number of bits to consume (at most BitCount)
  */
-static byte_t
-Huffin (void)
+static void
+DropBits (struct Arc* arc, unsigned count)
 {
-  unsigned long hcode = 0;
-  unsigned long mask  = 1;
-  int  size  = 1;
-  int  now;
+  arc->BitBuf >>= count;
+  arc->BitCount -= count;
 
-  now = hcount;       /* First non-zero Huffman code */
+  if (arc->BitEnd != NOBITEND) {
+    if (count > arc->BitEnd) {
+      arc->Status = EOF;
+      arc->BitEnd = 0;
+    }
+    else
+      arc->BitEnd -= count;
+  }
+}
 
-  do {
-    if (GetBit ())
-      hcode |= mask;
+/** Receive bits from the input, least significant bit first
+ * @param arc   the decoder state
+ * @param count number of bits to receive (at most 24)
+ * @return      the received bits
+ */
+static unsigned long
+GetBits (struct Arc* arc, unsigned count)
+{
+  unsigned long bits;
 
-    while( hl[now] == size) {
+  FillBits (arc, count);
+  bits = arc->BitBuf & ((1UL << count) - 1);
+  DropBits (arc, count);
+  return bits;
+}
 
-      if (hc[now] == hcode)
-        return hv[now];
+/** Reverse the order of bits
+ * @param bits  the bits to be reversed
+ * @param count number of bits (at most 16)
+ * @return      the bits in reverse order
+ */
+static unsigned
+ReverseBits (unsigned long bits, unsigned count)
+{
+  unsigned u = (unsigned) bits;
+  u = ((u & 0x5555) << 1) | ((u >> 1) & 0x5555);
+  u = ((u & 0x3333) << 2) | ((u >> 2) & 0x3333);
+  u = ((u & 0x0f0f) << 4) | ((u >> 4) & 0x0f0f);
+  u = ((u & 0x00ff) << 8) | ((u >> 8) & 0x00ff);
+  return u >> (16 - count);
+}
 
-      if (--now < 0) {         /* Error in decode table */
-        Status = EOF;
-        return 0;
-      }
+/** Build a Huffman decoding table from the codes sorted by ssort()
+ * @param arc   the decoder state
+ * @param table offset of the table in arc->huff
+ * @param prefix the code bits that lead to the table
+ * @param base  number of bits in prefix
+ * @param bits  number of index bits in the table
+ * @param error number of bits to consume on an invalid code
+ */
+static void
+BuildHuff (struct Arc* arc,
+           unsigned table,
+           unsigned long prefix,
+           unsigned base,
+           unsigned bits,
+           unsigned error)
+{
+  struct Huff* t = &arc->huff[table];
+  unsigned long mask = (1UL << base) - 1;
+  unsigned i;
+  int n;
+
+  for (i = 0; i < 1U << bits; i++) {
+    t[i].value = 0;
+    t[i].length = (byte_t) error;
+    t[i].type = HuffError;
+  }
+
+  /* Fill in the codes that end in this table.  The linear search used
+     to pick the first match in the order of ascending length and
+     descending index, which is the reverse of the sorted order. */
+  for (n = 0; n <= arc->hcount; n++) {
+    unsigned length = arc->hl[n];
+
+    if (length <= base || length > base + bits ||
+        (arc->hc[n] & mask) != prefix)
+      continue;
+
+    for (i = (unsigned) (arc->hc[n] >> base); i < 1U << bits;
+         i += 1U << (length - base)) {
+      t[i].value = arc->hv[n];
+      t[i].length = (byte_t) length;
+      t[i].type = HuffByte;
     }
-    size++;
-    mask = mask << 1;
-  } while (size < 24);
+  }
+
+  /* Create sub-tables for the longer codes. */
+  for (n = 0; n <= arc->hcount; n++) {
+    unsigned long subprefix, submask = (1UL << (base + bits)) - 1;
+    unsigned length = arc->hl[n], subbits = 0;
+    int m;
+
+    if (length <= base + bits || length > HUFFMAX ||
+        (arc->hc[n] & mask) != prefix)
+      continue;
 
-  Status = EOF;                /* Error. Huffman code too big */
+    i = (unsigned) (arc->hc[n] >> base) & ((1U << bits) - 1);
+
+    if (t[i].type != HuffError)
+      continue; /* a shorter code or an existing sub-table */
+
+    subprefix = arc->hc[n] & submask;
+
+    for (m = 0; m <= arc->hcount; m++)
+      if (arc->hl[m] > base + bits + subbits && arc->hl[m] <= HUFFMAX &&
+          (arc->hc[m] & submask) == subprefix)
+        subbits = arc->hl[m] - base - bits;
+
+    if (subbits > HUFFSUB)
+      subbits = HUFFSUB;
+
+    t[i].value = (unsigned short) arc->huffSize;
+    t[i].length = (byte_t) subbits;
+    t[i].type = HuffTable;
+    arc->huffSize += 1U << subbits;
+
+    BuildHuff (arc, t[i].value, subprefix, base + bits, subbits, error);
+  }
+}
+
+/** Fetch a Huffman code and convert it to what it represents
+ * @param arc   the decoder state
+ * @return      the converted code
+ */
+static byte_t
+Huffin (struct Arc* arc)
+{
+  const struct Huff* h;
+  unsigned long hcode;
+  unsigned shift = HUFFROOT;
+
+  FillBits (arc, HUFFMAX);
+  hcode = arc->BitBuf;
+  h = &arc->huff[hcode & ((1U << HUFFROOT) - 1)];
+
+  while (h->type == HuffTable) {
+    unsigned index = (unsigned) (hcode >> shift) & ((1U << h->length) - 1);
+    shift += h->length;
+    h = &arc->huff[h->value + index];
+  }
+
+  DropBits (arc, h->length);
+
+  if (h->type == HuffByte)
+    return (byte_t) h->value;
+
+  arc->Status = EOF;        /* Error in decode table, or code too big */
   return 0;
 }
 
 /** Fetch ARC64 header.
+ * @param arc   the decoder state
  * @return      true if header is ok.
  */
 static bool
-GetHeader (void)
+GetHeader (struct Arc* arc)
 {
-  unsigned int  w, i;
+  unsigned int  w;
   const char LegalTypes[] = "SPUR";
-  unsigned long mask;
 
-  if (feof(fp) || ferror(fp))
+  if (arc->eof)
     return false;
   else
-    Status = 0;
-
-  BitBuf        = 2;              /* Clear Bit buffer */
-  crc           = 0;              /* checksum */
-  crc2          = 0;              /* Used in checksum calculation */
-  State         = 0;              /* LZW state */
-  ctrl          = 254;            /* Run-Length control character */
-
-  entry.version = GetByte();
-  entry.mode    = GetByte();
-  entry.check   = GetWord();
-  entry.size    = GetThree();
-  entry.blocks  = GetWord();
-  entry.type    = GetByte();
-  entry.fnlen   = GetByte();
+    arc->Status = 0;
+
+  ClearBits (arc);                     /* Clear Bit buffer */
+  arc->crc           = 0;              /* checksum */
+  arc->crc2          = 0;              /* Used in checksum calculation */
+  arc->State         = 0;              /* LZW state */
+  arc->ctrl          = 254;            /* Run-Length control character */
+
+  arc->entry.version = GetByte(arc);
+  arc->entry.mode    = GetByte(arc);
+  arc->entry.check   = GetWord(arc);
+  arc->entry.size    = GetThree(arc);
+  arc->entry.blocks  = GetWord(arc);
+  arc->entry.type    = GetByte(arc);
+  arc->entry.fnlen   = GetByte(arc);
 
   /* Check for invalid header, If invalid, then we've input past the end */
   /* Possibly due to XMODEM padding or whatever */
 
-  if (entry.fnlen > 16)
+  if (arc->entry.fnlen > 16)
     return 0;
 
-  for (w=0; w < entry.fnlen; w++)
-    entry.name[w] = GetByte();
+  for (w=0; w < arc->entry.fnlen; w++)
+    arc->entry.name[w] = GetByte(arc);
 
-  entry.name[entry.fnlen] = 0;
+  arc->entry.name[arc->entry.fnlen] = 0;
 
-  if (entry.version > 1) {
-    entry.rl  = GetByte();
-    entry.date= GetWord();
+  if (arc->entry.version > 1) {
+    arc->entry.rl  = GetByte(arc);
+    arc->entry.date= GetWord(arc);
   }
 
-  if (Status == EOF)
+  if (arc->Status == EOF)
     return false;
 
-  if (entry.version == 0 || entry.version > 2)
+  if (arc->entry.version == 0 || arc->entry.version > 2)
     return false;
 
-  if (entry.version == 1) { /* If ARC64 version 1.xx */
-    if (entry.mode > 2)     /* Only store, pack, squeeze */
+  if (arc->entry.version == 1) { /* If ARC64 version 1.xx */
+    if (arc->entry.mode > 2)     /* Only store, pack, squeeze */
       return false;
   }
-  if (entry.mode == 1)      /* If packed get control char */
-    ctrl = GetByte();       /* V2 always uses 0xfe V1 varies */
+  if (arc->entry.mode == 1)      /* If packed get control char */
+    arc->ctrl = GetByte(arc);       /* V2 always uses 0xfe V1 varies */
 
-  if (entry.mode > 5)
+  if (arc->entry.mode > 5)
     return false;
 
-  if ((entry.mode == 2) || (entry.mode == 4)) { /* if squeezed or squashed */
-    hcount = 255;                                 /* Will be first code */
+  if ((arc->entry.mode == 2) || (arc->entry.mode == 4)) { /* if squeezed or squashed */
+    arc->hcount = 255;                                 /* Will be first code */
 
     for (w=0; w<256; w++) {                       /* Fetch Huffman codes */
-      hv[w] = (unsigned char) w;
-
-      hl[w]=0;
-      mask = 1;
-      for (i=1; i<6; i++) {
-        if (GetBit())
-          hl[w] |= (unsigned char) mask;
-        mask <<= 1;
-      }
+      arc->hv[w] = (unsigned char) w;
+
+      arc->hl[w] = (unsigned char) GetBits (arc, 5);
 
-      if (hl[w] > 24)
+      if (arc->hl[w] > 24)
         return false;                             /* Code too big */
 
-      hc[w] = 0;
-      if (hl[w]) {
-        i = 0;
-        mask = 1;
-        while (i<hl[w]) {
-          if (GetBit())
-            hc[w] |= mask;
-          i++;
-          mask <<= 1;
-        }
-      }
+      arc->hc[w] = 0;
+      if (arc->hl[w])
+        arc->hc[w] = GetBits (arc, arc->hl[w]);
       else
-        hcount--;
+        arc->hcount--;
     }
-    ssort ();
+    ssort (arc);
+
+    /* An invalid code used to be detected after reading the longest
+       code length, or HUFFMAX bits. */
+    arc->huffSize = 1U << HUFFROOT;
+    BuildHuff (arc, 0, 0, 0, HUFFROOT,
+               arc->hcount >= 0 && arc->hl[0] <= HUFFMAX
+               ? arc->hl[0] : HUFFMAX);
   }
 
-  return !!strchr (LegalTypes, entry.type);
+  return !!strchr (LegalTypes, arc->entry.type);
 }
 
 /** Get start of data.  Ignores SDA header.
+ * @param arc   the decoder state
  * @return      the starting position of useful data within the file
  *              (normally 0), or -1 if not an archive
  */
 static long
-GetStartPos (void)
+GetStartPos (struct Arc* arc)
 {
   int c;                      /* Temp */
   int cpu;                    /* C64 or C128 if SDA */
   word_t linenum;             /* Sys line number */
   word_t skip;                /* Size of SDA header in bytes */
 
-  fseek(fp, 0, SEEK_SET);     /* Goto start of file */
-  Status = 0;
+  SeekArc (arc, 0);           /* Goto start of file */
+  arc->Status = 0;
 
-  if ( (c=GetByte()) == 2)    /* Probably type 2 archive */
+  if ( (c=GetByte(arc)) == 2)    /* Probably type 2 archive */
     return 0;                 /* Data starts at offset 0 */
 
   if (c != 1)                 /* IBM archive, or not an archive at all */
@@ -383,15 +618,15 @@ GetStartPos (void)
 
   /* Check if its an SDA */
 
-  GetByte();           /* Skip to line number (which is # of header blocks) */
-  GetWord();
-  linenum = GetWord();
+  GetByte(arc);           /* Skip to line number (which is # of header blocks) */
+  GetWord(arc);
+  linenum = GetWord(arc);
 
-  if (GetByte() != 0x9e)      /* Must be BASIC SYS token */
+  if (GetByte(arc) != 0x9e)      /* Must be BASIC SYS token */
     return 0;                 /* Else probably type 1 archive */
 
-  GetByte();                  /* Get SYS address */
-  cpu = GetByte();            /* '2' for C64, '7' for C128 */
+  GetByte(arc);                  /* Get SYS address */
+  cpu = GetByte(arc);            /* '2' for C64, '7' for C128 */
 
   skip = (linenum-6)*254;     /* True except for SDA232.128 */
 
@@ -415,191 +650,206 @@ GetStartPos (void)
  */
 
 /** Push a byte to the Lempel Zev stack
+ * @param arc   the decoder state
  * @param c     the byte to be pushed
  */
 static void
-push (byte_t c)
+push (struct Arc* arc, byte_t c)
 {
-  if (lzstack >= sizeof stack)
-    longjmp (LZStackError, PushError);
+  if (arc->lzstack >= sizeof arc->stack)
+    longjmp (arc->LZStackError, PushError);
   else
-    stack[lzstack++] = c;
+    arc->stack[arc->lzstack++] = c;
 }
 
 /** Pop a byte from the Lempel Zev stack
+ * @param arc   the decoder state
  * @return      the popped byte
  */
 static byte_t
-pop (void)
+pop (struct Arc* arc)
 {
-  if (!lzstack)
-    longjmp (LZStackError, PopError);
+  if (!arc->lzstack)
+    longjmp (arc->LZStackError, PopError);
   else
-    return stack[--lzstack];
+    return arc->stack[--arc->lzstack];
 }
 
 /** Fetch LZ code
+ * @param arc   the decoder state
  * @return      the fetched code
  */
-static unsigned int getcode (void)
+static unsigned int getcode (struct Arc* arc)
 {
-  register int i;
-  long blocks;
+  size_t blocks;
 
-  code = 0;
-  i = cdlen;
-
-  while(i--)
-    code = (code << 1) | GetBit ();
+  arc->code = ReverseBits (GetBits (arc, (unsigned) arc->cdlen),
+                           (unsigned) arc->cdlen);
 
   /*  Special case of 1 pass crunch. Checksum and size are at the end */
 
-  if ((code == 256) && (entry.mode == 5)) {
-    i = 16;
-    entry.check = 0;
-    while (i--)
-      entry.check = (entry.check << 1) | GetBit ();
-    i = 24;
-    entry.size = 0;
-    while (i--)
-      entry.size = (entry.size << 1) | GetBit ();
-    i = 16;
-    while (i--)                     /* This was never implemented */
-      GetBit ();
-    blocks = ftell(fp)-FilePos;
-    entry.blocks = (unsigned) (blocks / 254);
+  if ((arc->code == 256) && (arc->entry.mode == 5)) {
+    arc->entry.check = ReverseBits (GetBits (arc, 16), 16);
+    arc->entry.size = (size_t) ReverseBits (GetBits (arc, 16), 16) << 8;
+    arc->entry.size |= ReverseBits (GetBits (arc, 8), 8);
+    GetBits (arc, 16);              /* This was never implemented */
+    /* the bytes that GetByte() would have read */
+    blocks = arc->pos - arc->BitCount / 8 - arc->FilePos;
+    arc->entry.blocks = (unsigned) (blocks / 254);
     if (blocks % 254)
-      entry.blocks++;
+      arc->entry.blocks++;
   }
 
   /* Get ready for next time */
 
-  if ((cdlen < 12)) {
-    if (!(--wttcl)) {
-      wtcl = wtcl << 1;
-      cdlen++;
-      wttcl = wtcl;
+  if ((arc->cdlen < 12)) {
+    if (!(--arc->wttcl)) {
+      arc->wtcl = arc->wtcl << 1;
+      arc->cdlen++;
+      arc->wttcl = arc->wtcl;
     }
   }
 
-  return code;
+  return arc->code;
 }
 
 /** Un-crunch a byte
+ * @param arc   the decoder state
  * @return      the uncrunched byte
  */
 static byte_t
-unc (void)
+unc (struct Arc* arc)
 {
-  static unsigned oldcode, incode;
-  static byte_t kay;
-  static unsigned omega;
-  static unsigned char finchar;
-  static unsigned ncodes;   /* Current # of codes in table */
-
-  switch (State) {
+  switch (arc->State) {
 
   case 0:                  /* First time. Reset. */
-    lzstack = 0;
-    ncodes  = 258;         /* 2 reserved codes */
-    wtcl    = 256;         /* 256 Bump code size when we get here */
-    wttcl   = 254;         /* 1st time only 254 due to resvd codes */
-    cdlen   = 9;           /* Start with 9 bit codes */
-    oldcode = getcode();
-
-    if (oldcode == 256) {  /* Code 256 is EOF for this entry */
-      Status = EOF;        /* (ie. a zero length file) */
+    arc->lzstack = 0;
+    arc->ncodes  = 258;         /* 2 reserved codes */
+    arc->wtcl    = 256;         /* 256 Bump code size when we get here */
+    arc->wttcl   = 254;         /* 1st time only 254 due to resvd codes */
+    arc->cdlen   = 9;           /* Start with 9 bit codes */
+    arc->oldcode = getcode(arc);
+
+    if (arc->oldcode == 256) {  /* Code 256 is EOF for this entry */
+      arc->Status = EOF;        /* (ie. a zero length file) */
       return 0;
     }
-    kay = (byte_t) oldcode;
-    finchar = kay;
-    State = 1;
-    return kay;
+    arc->kay = (byte_t) arc->oldcode;
+    arc->finchar = arc->kay;
+    arc->State = 1;
+    return arc->kay;
 
   case 1:
-    incode = getcode();
+    arc->incode = getcode(arc);
 
-    if (incode == 256) {
-      State = 0;
-      Status = EOF;
+    if (arc->incode == 256) {
+      arc->State = 0;
+      arc->Status = EOF;
       return 0;
     }
 
-    if (incode >= ncodes) {     /* Undefined code, special case */
-      kay = finchar;
-      push(kay);
-      code = oldcode;
-      omega = oldcode;
-      incode = ncodes;
+    if (arc->incode >= arc->ncodes) {     /* Undefined code, special case */
+      arc->kay = arc->finchar;
+      push (arc, arc->kay);
+      arc->code = arc->oldcode;
+      arc->omega = arc->oldcode;
+      arc->incode = arc->ncodes;
     }
-    while ( code > 255 ) {      /* Decompose string */
-      push(lztab[code].ext);
-      code = lztab[code].prefix;
+    while ( arc->code > 255 ) {      /* Decompose string */
+      push (arc, arc->lztab[arc->code].ext);
+      arc->code = arc->lztab[arc->code].prefix;
     }
-    finchar = kay = (byte_t) code;
-    State = 2;
-    return kay;
+    arc->finchar = arc->kay = (byte_t) arc->code;
+    arc->State = 2;
+    return arc->kay;
 
   case 2:
-    if (!lzstack) {             /* Empty stack */
-      omega = oldcode;
-      if (ncodes < sizeof lztab / sizeof *lztab) {
-        lztab[ncodes].prefix = omega;
-        lztab[ncodes].ext = kay;
-        ncodes++;
+    if (!arc->lzstack) {             /* Empty stack */
+      arc->omega = arc->oldcode;
+      if (arc->ncodes < sizeof arc->lztab / sizeof *arc->lztab) {
+        arc->lztab[arc->ncodes].prefix = arc->omega;
+        arc->lztab[arc->ncodes].ext = arc->kay;
+        arc->ncodes++;
       }
-      oldcode = incode;
-      State = 1;
-      return unc();
+      arc->oldcode = arc->incode;
+      arc->State = 1;
+      return unc(arc);
     }
     else
-      return pop();
+      return pop(arc);
   }
 
-  Status = EOF;
+  arc->Status = EOF;
   return 0;
 }
 
 /** Update the checksum
+ * @param arc   the decoder state
  * @param c     the data to be added to the checksum
  */
 static void
-UpdateChecksum (byte_t c)
+UpdateChecksum (struct Arc* arc, byte_t c)
 {
   c &= 0xff;
 
-  if (entry.version == 1)     /* Simple checksum for version 1 */
-    crc += c;
+  if (arc->entry.version == 1)     /* Simple checksum for version 1 */
+    arc->crc += c;
   else
-    crc += (c ^ (++crc2));    /* A slightly better checksum for version 2 */
+    arc->crc += (c ^ (++arc->crc2));    /* A slightly better checksum for version 2 */
 }
 
 /** Unpack a byte
+ * @param arc   the decoder state
  * @return      the unpacked byte
  */
 static byte_t
-UnPack (void)
+UnPack (struct Arc* arc)
 {
-  switch (entry.mode) {
+  switch (arc->entry.mode) {
 
   case 0:             /* Stored */
   case 1:             /* Packed (Run-Length) */
-    return GetByte();
+    return GetByte(arc);
 
   case 2:             /* Squeezed (Huffman only) */
   case 4:             /* Squashed (Huffman + Run-Length) */
-    return Huffin();
+    return Huffin(arc);
 
   case 3:             /* Crunched */
   case 5:             /* Crunched in one pass */
-    return unc();
+    return unc(arc);
 
   default:            /* Otherwise ERROR */
-    Status = EOF;
+    arc->Status = EOF;
     return 0;
   }
 }
 
+/** Make room in the output buffer
+ * @param arc   the decoder state
+ * @param size  minimum size of the buffer
+ * @param limit maximum length of the output
+ * @return      true if successful, false if out of memory
+ */
+static bool
+GrowBuffer (struct Arc* arc, size_t size, size_t limit)
+{
+  size_t newSize = arc->bufSize < 128 ? 256 : arc->bufSize * 2;
+  byte_t* buffer;
+
+  if (newSize > limit)
+    newSize = limit;
+  if (newSize < size)
+    newSize = size;
+
+  if (!(buffer = realloc (arc->buffer, newSize)))
+    return false;
+
+  arc->buffer = buffer;
+  arc->bufSize = newSize;
+  return true;
+}
+
 /** Read and convert an ARC/SDA archive
  * @param file          the file input stream
  * @param filename      host system name of the file
@@ -613,84 +863,130 @@ ReadARC (FILE* file,
          write_file_t writeCallback,
          log_t log)
 {
+  struct Arc* arc;
+  enum RdStatus status = RdOK;
+
   (void) filename; /* unused */
 
-  fp = file;
+  if (!(arc = calloc (1, sizeof *arc))) {
+    (*log) (Errors, 0, "Out of memory.");
+    return RdFail;
+  }
+
+  /* Read the whole archive to memory. */
+  {
+    long length;
 
-  switch (setjmp (LZStackError)) {
+    if (fseek (file, 0, SEEK_END) || (length = ftell (file)) < 0 ||
+        fseek (file, 0, SEEK_SET)) {
+      (*log) (Errors, 0, "fseek: %s", strerror(errno));
+      status = RdFail;
+      goto done;
+    }
+
+    arc->size = (size_t) length;
+
+    if (!(arc->data = malloc (arc->size ? arc->size : 1))) {
+      (*log) (Errors, 0, "Out of memory.");
+      status = RdFail;
+      goto done;
+    }
+
+    if (arc->size != fread (arc->data, 1, arc->size, file)) {
+      (*log) (Errors, 0, "fread: %s", strerror(errno));
+      status = RdFail;
+      goto done;
+    }
+  }
+
+  switch (setjmp (arc->LZStackError)) {
   case PopError:
     (*log) (Errors, 0, "Lempel Zev stack underflow");
-    return RdFail;
+    status = RdFail;
+    goto done;
   case PushError:
     (*log) (Errors, 0, "Lempel Zev stack overflow");
-    return RdFail;
+    status = RdFail;
+    goto done;
   }
 
   {
     long temp;
 
-    if ((temp = GetStartPos()) < 0) {
+    if ((temp = GetStartPos (arc)) < 0) {
       (*log) (Errors, 0, "Not a Commodore ARC or SDA.");
-      return RdFail;
-    }
-    else if (fseek (fp, temp, SEEK_SET)) {
-      (*log) (Errors, 0, "fseek: %s", strerror(errno));
-      return RdFail;
+      status = RdFail;
+      goto done;
     }
-  }
 
-  FilePos = ftell (fp);
+    SeekArc (arc, arc->FilePos = (size_t) temp);
+  }
 
-  while (GetHeader()) {
-    byte_t* buffer;
-    byte_t* buf;
+  while (GetHeader (arc)) {
     struct Filename name;
     enum WrStatus wrStatus;
-
-    size_t length = entry.size;
-
-    if (entry.mode == 5) /* If 1 pass crunch size is unknown */
-      length = 65536; /* 64kB should be enough for everyone */
-
-    if (!(buf = buffer = malloc (length))) {
+    size_t length, count;
+    /* The size of a file crunched in one pass is stored at its end. */
+    size_t limit = arc->entry.mode == 5
+      ? ARCMAXSIZE + 1 : arc->entry.size;
+    /* When listing, report the size that is stored in the header,
+       unless the file was crunched in one pass. */
+    bool decode = !listFile || arc->entry.mode == 5;
+
+    /* Keep the buffer allocated even for empty files. */
+    if (!arc->buffer && !GrowBuffer (arc, 1, 1)) {
       (*log) (Errors, 0, "Out of memory.");
-      return RdFail;
+      status = RdFail;
+      goto done;
     }
 
-    while (buf < &buffer[length]) {
-      byte_t c = UnPack ();
+    if (!decode)
+      length = arc->entry.size;
+    else
+      for (length = 0; length < limit; ) {
+        byte_t c = UnPack (arc);
+        count = 1;
 
-      if (Status == EOF)
-        break;
+        if (arc->Status == EOF)
+          break;
 
-      /* If Run Length is needed */
+        /* If Run Length is needed */
 
-      if (entry.mode != 0 && entry.mode != 2 && c == ctrl) {
-        int count = UnPack ();
-        c = UnPack ();
+        if (arc->entry.mode != 0 && arc->entry.mode != 2 && c == arc->ctrl) {
+          count = UnPack (arc);
+          c = UnPack (arc);
 
-        if (Status == EOF)
-          break;
+          if (arc->Status == EOF)
+            break;
 
-        if (count == 0)
-          count = entry.version == 1 ? 255 : 256;
+          if (count == 0)
+            count = arc->entry.version == 1 ? 255 : 256;
 
-        while (--count)
-          UpdateChecksum (*buf++ = c);
-      }
+          /* A run must not extend past the end of the file. */
+          if (count > limit - length)
+            count = limit - length;
+        }
 
-      UpdateChecksum (*buf++ = c);
-    }
+        if (length + count > arc->bufSize &&
+            !GrowBuffer (arc, length + count, limit)) {
+          (*log) (Errors, 0, "Out of memory.");
+          status = RdFail;
+          goto done;
+        }
+
+        while (count--)
+          UpdateChecksum (arc, arc->buffer[length++] = c);
+      }
 
     /* Set up the file name information */
     {
-      unsigned i = entry.fnlen < sizeof name.name
-        ? entry.fnlen : sizeof name.name;
+      unsigned i = arc->entry.fnlen < sizeof name.name
+        ? arc->entry.fnlen : sizeof name.name;
       /* pad the file name with shifted spaces */
       memset(name.name, 0xa0, sizeof name.name);
-      memcpy(name.name, entry.name, i);
+      memcpy(name.name, arc->entry.name, i);
 
-      switch (entry.type) {
+      switch (arc->entry.type) {
       case 'S':
         name.type = SEQ;
         break;
@@ -702,7 +998,7 @@ ReadARC (FILE* file,
         break;
       case 'R':
         name.type = REL;
-        name.recordLength = entry.rl;
+        name.recordLength = arc->entry.rl;
         break;
       default:
         (*log) (Errors, &name, "Unknown type, defaulting to DEL");
@@ -711,29 +1007,44 @@ ReadARC (FILE* file,
       }
     }
 
-    if ((crc ^ entry.check) & 0xffff)
-      (*log) (Errors, &name, "Checksum error!");
+    if (length > ARCMAXSIZE) {
+      (*log) (Errors, &name, "File too long");
+      status = RdFail;
+      goto done;
+    }
 
-    wrStatus = (*writeCallback) (&name, buffer, (size_t) (buf - buffer));
-    free (buffer);
+    if (!decode)
+      wrStatus = (*listFile) (&name, length);
+    else {
+      if ((arc->crc ^ arc->entry.check) & 0xffff)
+        (*log) (Errors, &name, "Checksum error!");
+      else if (length != arc->entry.size)
+        (*log) (Errors, &name, "File size mismatch");
+
+      wrStatus = listFile
+        ? (*listFile) (&name, length)
+        : (*writeCallback) (&name, arc->buffer, length);
+    }
 
     switch (wrStatus) {
     case WrOK:
       break;
     case WrNoSpace:
-      return RdNoSpace;
+      status = RdNoSpace;
+      goto done;
     case WrFail:
     case WrFileExists:
-      return RdFail;
+      status = RdFail;
+      goto done;
     }
 
-    FilePos += (long)entry.blocks * 254;
-
-    if (fseek (fp, FilePos, SEEK_SET)) {
-      (*log) (Errors, 0, "fseek: %s", strerror (errno));
-      return RdFail;
-    }
+    arc->FilePos += (size_t) arc->entry.blocks * 254;
+    SeekArc (arc, arc->FilePos);
   }
 
-  return RdOK;
+done:
+  free (arc->buffer);
+  free (arc->data);
+  free (arc);
+  return status;
 }
@@ -52,28 +52,39 @@ struct ArkiveEntry
   byte_t blocksHigh;
 };
 
+/** A file in an Arkive archive */
+struct ArkiveFile
+{
+  /** the file name and type */
+  struct Filename name;
+  /** position of the contents in the archive */
+  size_t pos;
+  /** length of the contents in bytes */
+  size_t length;
+};
+
 /** Read and convert an Arkive archive
  * @param file          the file input stream
- * @param filename      host system name of the file
  * @param writeCallback function for writing the contained files
  * @param log           Call-back function for diagnostic output
+ * @param arena         memory arena for the file contents
  * @return              status of the operation
  */
-enum RdStatus
-ReadArkive (FILE* file,
-            const char* filename,
+static enum RdStatus
+readArkive (FILE* file,
             write_file_t writeCallback,
-            log_t log)
+            log_t log,
+            struct Arena* arena)
 {
-  struct Filename name;
-  struct ArkiveEntry entry;
-  int f, fcount;
+  struct ArkiveEntry* entries;
+  struct ArkiveFile* files;
+  int f, fcount, count;
+  bool hdrFail = false; /* set if the directory could not be read */
 
   /* File positions */
-  size_t headerPos; /* current header position */
+  size_t headerPos; /* header position */
   size_t archivePos; /* current archive position */
-
-  (void) filename; /* unused */
+  long archiveEnd = 0; /* end of the archive (only determined for listing) */
 
   if (EOF == (fcount = fgetc (file))) {
   hdrError:
@@ -88,44 +99,50 @@ ReadArkive (FILE* file,
   }
 
   archivePos =
-    254 * rounddiv (headerPos + (size_t) fcount * sizeof entry, 254);
+    254 * rounddiv (headerPos + (size_t) fcount * sizeof *entries, 254);
 
-  /* start extracting files */
+  if (!(files = arenaAlloc (arena, (size_t) fcount * sizeof *files)) ||
+      !(entries = arenaAlloc (arena, (size_t) fcount * sizeof *entries))) {
+    (*log) (Errors, 0, "Out of memory.");
+    return RdFail;
+  }
 
-  for (f = 0; f++ < fcount;) {
-    size_t length;
-    unsigned blocks;
+  /* Read the whole directory, and determine the position and length
+     of each file, so that the contents can be read sequentially. */
 
-    if (fseek (file, (long) headerPos, SEEK_SET) ||
-        1 != fread (&entry, sizeof entry, 1, file))
-      goto hdrError;
+  count = (int) fread (entries, sizeof *entries, (size_t) fcount, file);
 
-    headerPos += sizeof entry;
+  for (f = 0; f < count; f++) {
+    const struct ArkiveEntry* entry = &entries[f];
+    struct Filename* name = &files[f].name;
+    size_t length;
+    unsigned blocks;
 
     /* copy file name */
-    memcpy (name.name, entry.name, 16);
+    memcpy (name->name, entry->name, 16);
 
     /* copy the record length */
-    name.recordLength = entry.recordLength;
+    name->recordLength = entry->recordLength;
 
     /* determine file length */
-    blocks = (unsigned) (entry.blocksLow | ((unsigned) entry.blocksHigh << 8));
-    length = 254 * blocks + entry.lastSectorLength - 255;
+    blocks = (unsigned) (entry->blocksLow |
+                         ((unsigned) entry->blocksHigh << 8));
+    length = 254 * blocks + entry->lastSectorLength - 255;
 
     /* determine file type */
 
-    switch (entry.filetype & ~0x38) {
+    switch (entry->filetype & ~0x38) {
     case DEL:
     case SEQ:
     case PRG:
-      name.type = (enum Filetype) (entry.filetype & ~0x38);
+      name->type = (enum Filetype) (entry->filetype & ~0x38);
       break;
 
     case REL:
-      name.type = REL;
+      name->type = REL;
 
-      if (!name.recordLength)
-        (*log) (Warnings, &name, "zero record length");
+      if (!name->recordLength)
+        (*log) (Warnings, name, "zero record length");
 
       {
         unsigned sidesectCount, sidesectLastLength;
@@ -133,77 +150,131 @@ ReadArkive (FILE* file,
         sidesectCount = (blocks + 119) / 121;
         sidesectLastLength = 15 + 2 * ((blocks - sidesectCount) % 120);
 
-        if (entry.sidesectCount != sidesectCount ||
+        if (entry->sidesectCount != sidesectCount ||
             blocks < sidesectCount ||
-            entry.sidesectLastLength != sidesectLastLength) {
-          (*log) (Errors, &name, "improper side sector length");
-          (*log) (Errors, &name, "Following files may be totally wrong!");
+            entry->sidesectLastLength != sidesectLastLength) {
+          (*log) (Errors, name, "improper side sector length");
+          (*log) (Errors, name, "Following files may be totally wrong!");
         }
 
         length = (blocks - sidesectCount) * 254 - 255 +
-          entry.lastSectorLength;
+          entry->lastSectorLength;
       }
 
       break;
 
     default:
-      (*log) (Errors, &name, "Unknown type, defaulting to DEL");
-      name.type = DEL;
+      (*log) (Errors, name, "Unknown type, defaulting to DEL");
+      name->type = DEL;
       break;
     }
 
     if (length >= 254 * 3200/* 1581 disk image size */) {
-      (*log) (Errors, &name, "incorrect file length: %zu bytes", length);
-      return RdFail;
+      (*log) (Errors, name, "incorrect file length: %zu bytes", length);
+      hdrFail = true;
+      break;
     }
 
-    /* read the file */
+    files[f].pos = archivePos;
+    files[f].length = length;
+
+    archivePos += 254 * blocks;
+
+    if (name->type == REL)
+      /* Arkive stores the last side sector, */
+      /* wasting 254 bytes */
+      /* for each relative file. */
+      archivePos -= 254U * (entry->sidesectCount - 1);
+  }
+
+  arenaFree (arena, entries);
+
+  if (count < fcount && !hdrFail) {
+    (*log) (Errors, 0, "File header read failed: %s", strerror(errno));
+    hdrFail = true;
+  }
+
+  /* When listing, determine the length of the archive, so that
+     truncated files can be detected without reading them. */
+  if (listFile && f &&
+      (fseek (file, 0, SEEK_END) || (archiveEnd = ftell (file)) < 0)) {
+    (*log) (Errors, 0, "fseek: %s", strerror(errno));
+    return RdFail;
+  }
+
+  /* Extract the files */
+
+  for (count = f, f = 0; f < count; f++) {
+    const struct ArkiveFile* af = &files[f];
+    enum WrStatus wrStatus;
+    byte_t* buf;
 
-    {
-      enum WrStatus wrStatus;
-      byte_t* buf;
+    if (locateFile)
+      (*locateFile) ((long) af->pos, 0, 0);
 
-      if (fseek (file, (long) archivePos, SEEK_SET)) {
-        (*log) (Errors, &name, "fseek: %s", strerror(errno));
+    if (listFile) {
+      if (af->pos + af->length > (size_t) archiveEnd) {
+        (*log) (Errors, &af->name, "Truncated file");
+        wrStatus = WrFail;
+      }
+      else
+        wrStatus = (*listFile) (&af->name, af->length);
+    }
+    else {
+      if (fseek (file, (long) af->pos, SEEK_SET)) {
+        (*log) (Errors, &af->name, "fseek: %s", strerror(errno));
         return RdFail;
       }
 
-      if (!(buf = malloc (length))) {
-        (*log) (Errors, &name, "Out of memory.");
+      if (!(buf = arenaAlloc (arena, af->length))) {
+        (*log) (Errors, &af->name, "Out of memory.");
         return RdFail;
       }
 
-      if (length != fread (buf, 1, length, file)) {
-        (*log) (Errors, &name, "fread: %s", strerror(errno));
+      if (af->length != fread (buf, 1, af->length, file)) {
+        (*log) (Errors, &af->name, "fread: %s", strerror(errno));
         wrStatus = WrFail;
       }
-      else {
-        archivePos += 254 * blocks;
+      else
+        wrStatus = (*writeCallback) (&af->name, buf, af->length);
 
-        if (name.type == REL)
-          /* Arkive stores the last side sector, */
-          /* wasting 254 bytes */
-          /* for each relative file. */
-          archivePos -= 254U * (entry.sidesectCount - 1);
+      arenaFree (arena, buf);
+    }
 
-        wrStatus = (*writeCallback) (&name, buf, length);
-      }
+    switch (wrStatus) {
+    case WrOK:
+      continue;
+    case WrNoSpace:
+      return RdNoSpace;
+    case WrFail:
+    case WrFileExists:
+      break;
+    }
 
-      free (buf);
+    return RdFail;
+  }
 
-      switch (wrStatus) {
-      case WrOK:
-        continue;
-      case WrNoSpace:
-        return RdNoSpace;
-      case WrFail:
-      case WrFileExists:
-        break;
-      }
+  return hdrFail ? RdFail : RdOK;
+}
 
-      return RdFail;
-    }
-  }
+/** Read and convert an Arkive archive
+ * @param file          the file input stream
+ * @param filename      host system name of the file
+ * @param writeCallback function for writing the contained files
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+enum RdStatus
+ReadArkive (FILE* file,
+            const char* filename,
+            write_file_t writeCallback,
+            log_t log)
+{
+  struct Arena arena = { 0 };
+  enum RdStatus status = readArkive (file, writeCallback, log, &arena);
+
+  (void) filename; /* unused */
 
-  return RdOK;
+  arenaRelease (&arena);
+  return status;
 }
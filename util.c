@@ -23,6 +23,8 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "util.h"
 
@@ -80,3 +82,205 @@ getFilename (const struct Filename* name)
 
   return buf;
 }
+
+/** A chunk of memory in an arena */
+struct ArenaChunk
+{
+  /** the previously allocated chunk (NULL if none) */
+  struct ArenaChunk* prev;
+  /** the first unallocated byte */
+  byte_t* free;
+  /** the end of the chunk */
+  byte_t* end;
+  /** the memory, aligned for any data type */
+  union
+  {
+    long l;
+    double d;
+    void* p;
+  } data[1];
+};
+
+#ifndef NO_ARENA
+/** Minimum size of an arena chunk in bytes */
+# define ARENA_CHUNK 65536
+#endif
+
+/** Round up an allocation size to the alignment of ArenaChunk::data
+ * @param size  number of bytes to allocate
+ * @return      the aligned size, or 0 if it would overflow
+ */
+static size_t
+arenaSize (size_t size)
+{
+  const size_t align = sizeof ((struct ArenaChunk*) 0)->data;
+
+  if (size > ((size_t) -1) / 2)
+    return 0;
+
+  return size ? (size + align - 1) / align * align : align;
+}
+
+/** Allocate a chunk of memory and make it the current one of an arena.
+ * @param arena the memory arena
+ * @param size  size of the chunk in bytes
+ * @return      the start of the chunk, or NULL if out of memory
+ */
+static byte_t*
+newChunk (struct Arena* arena, size_t size)
+{
+  struct ArenaChunk* chunk;
+
+  if (!(chunk = malloc (offsetof (struct ArenaChunk, data) + size)))
+    return 0;
+
+  chunk->prev = arena->chunk;
+  chunk->free = (byte_t*) chunk->data;
+  chunk->end = chunk->free + size;
+  arena->chunk = chunk;
+  return chunk->free;
+}
+
+/** Allocate memory from an arena.
+ * @param arena the memory arena
+ * @param size  number of bytes to allocate
+ * @return      the allocated memory, or NULL if out of memory
+ */
+void*
+arenaAlloc (struct Arena* arena, size_t size)
+{
+  byte_t* ptr;
+
+  if (!(size = arenaSize (size)))
+    return 0;
+
+#ifndef NO_ARENA
+  {
+    struct ArenaChunk* chunk = arena->chunk;
+
+    if (chunk && size <= (size_t) (chunk->end - chunk->free))
+      ptr = chunk->free;
+    else {
+      /* Replace an empty chunk that is too small. */
+      if (chunk && chunk->free == (byte_t*) chunk->data) {
+        arena->chunk = chunk->prev;
+        free (chunk);
+      }
+
+      if (!(ptr = newChunk (arena, size < ARENA_CHUNK ? ARENA_CHUNK : size)))
+        return 0;
+    }
+  }
+#else
+  /* Allocate every buffer separately, for the benefit of memory checkers. */
+  if (!(ptr = newChunk (arena, size)))
+    return 0;
+#endif
+
+  arena->chunk->free = ptr + size;
+  return ptr;
+}
+
+/** Resize the most recent allocation of an arena, preserving its contents.
+ * @param arena the memory arena
+ * @param ptr   the most recently allocated memory, or NULL
+ * @param size  the new size in bytes
+ * @return      the reallocated memory, or NULL if out of memory
+ *              (in which case ptr is not freed)
+ */
+void*
+arenaGrow (struct Arena* arena, void* ptr, size_t size)
+{
+  struct ArenaChunk* chunk = arena->chunk;
+  byte_t* p = ptr;
+  size_t capacity;
+
+  if (!p)
+    return arenaAlloc (arena, size);
+
+  if (!(size = arenaSize (size)))
+    return 0;
+
+  capacity = size;
+
+#ifndef NO_ARENA
+  if (size <= (size_t) (chunk->end - p)) {
+    chunk->free = p + size;
+    return p;
+  }
+
+  /* Grow geometrically, to avoid copying the data for every extension. */
+  if (capacity < (size_t) (chunk->free - p) * 2)
+    capacity = (size_t) (chunk->free - p) * 2;
+  if (capacity < ARENA_CHUNK)
+    capacity = ARENA_CHUNK;
+
+  if (p != (byte_t*) chunk->data) {
+    /* Move the allocation to a chunk of its own. */
+    size_t length = (size_t) (chunk->free - p);
+    byte_t* q;
+
+    if (!(q = newChunk (arena, capacity)))
+      return 0;
+
+    memcpy (q, p, length < size ? length : size);
+    chunk->free = p;
+    arena->chunk->free = q + size;
+    return q;
+  }
+#endif
+
+  /* Resize the chunk that only contains this allocation. */
+  if (!(chunk = realloc (chunk, offsetof (struct ArenaChunk, data) + capacity)))
+    return 0;
+
+  chunk->free = (byte_t*) chunk->data + size;
+  chunk->end = (byte_t*) chunk->data + capacity;
+  arena->chunk = chunk;
+  return chunk->data;
+}
+
+/** Free memory and everything that was allocated after it from an arena.
+ * @param arena the memory arena
+ * @param ptr   memory returned by arenaAlloc() or arenaGrow(), or NULL
+ */
+void
+arenaFree (struct Arena* arena, void* ptr)
+{
+  byte_t* p = ptr;
+  struct ArenaChunk* chunk;
+
+  if (!p)
+    return;
+
+  while ((chunk = arena->chunk)) {
+    bool found = p >= (byte_t*) chunk->data && p < chunk->end;
+
+#ifndef NO_ARENA
+    if (found) {
+      chunk->free = p;
+      return;
+    }
+#endif
+
+    arena->chunk = chunk->prev;
+    free (chunk);
+
+    if (found)
+      return;
+  }
+}
+
+/** Free all memory of an arena.
+ * @param arena the memory arena
+ */
+void
+arenaRelease (struct Arena* arena)
+{
+  struct ArenaChunk* chunk;
+
+  while ((chunk = arena->chunk)) {
+    arena->chunk = chunk->prev;
+    free (chunk);
+  }
+}
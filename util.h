@@ -127,6 +127,19 @@ enum DirEntOpts
   DirEntDupCreate   /**< create new directory entries if the name exists */
 };
 
+/** Memory arena for short-lived buffers that are freed in the reverse
+    order of allocation */
+struct Arena
+{
+  /** the most recently allocated chunk of memory (NULL if none) */
+  struct ArenaChunk* chunk;
+};
+
+/** Maximum number of blocks in a disk image (the 1581) */
+#  define MAXBLOCKS 3200
+/** Number of bits in an element of a bitmap */
+#  define MAPBITS (sizeof (unsigned long) * CHAR_BIT)
+
 /** Disk image */
 struct Image
 {
@@ -146,6 +159,20 @@ struct Image
   byte_t partTops[80];
   /** parent partitions (for the 1581) */
   byte_t partUpper[80];
+  /** free blocks of the active partition, indexed by block number */
+  unsigned long freeMap[(MAXBLOCKS + MAPBITS - 1) / MAPBITS];
+  /** modified blocks, indexed by block number */
+  unsigned long dirtyMap[(MAXBLOCKS + MAPBITS - 1) / MAPBITS];
+  /** hash index of the directory (built by getDirEnt()) */
+  struct DirIndex* dirIndex;
+  /** flag: buf is a memory mapping of the disk image file */
+  bool mapped;
+  /** size of the disk image in bytes */
+  size_t size;
+  /** number of bytes written back by CloseImage() */
+  size_t written;
+  /** temporary buffers, such as block pointer tables and BAM copies */
+  struct Arena arena;
 };
 
 /** An entry in a file archive */
@@ -153,12 +180,14 @@ struct ArchiveEntry
 {
   /** Pointer to next archive entry */
   struct ArchiveEntry* next;
+  /** Next archive entry in the same hash chain */
+  struct ArchiveEntry* chain;
+  /** Hash value of the file name */
+  unsigned hash;
   /** The file name of the entry */
   struct Filename name;
   /** Length of the entry in bytes */
   size_t length;
-  /** The contents of the entry */
-  byte_t* data;
 };
 
 /** A file archive */
@@ -168,6 +197,14 @@ struct Archive
   struct ArchiveEntry* first;
   /** The last archive entry */
   struct ArchiveEntry* last;
+  /** Number of archive entries */
+  size_t count;
+  /** Hash chains of the entries by file name */
+  struct ArchiveEntry** chains;
+  /** Number of hash chains (a power of 2) */
+  size_t chainCount;
+  /** Temporary file holding the contents of the entries, in order */
+  FILE* data;
 };
 
 /* Utility functions */
@@ -179,6 +216,73 @@ struct Archive
 const char*
 getFilename (const struct Filename* name);
 
+/** Allocate memory from an arena.
+ * @param arena the memory arena
+ * @param size  number of bytes to allocate
+ * @return      the allocated memory, or NULL if out of memory
+ */
+void*
+arenaAlloc (struct Arena* arena, size_t size);
+
+/** Resize the most recent allocation of an arena, preserving its contents.
+ * @param arena the memory arena
+ * @param ptr   the most recently allocated memory, or NULL
+ * @param size  the new size in bytes
+ * @return      the reallocated memory, or NULL if out of memory
+ *              (in which case ptr is not freed)
+ */
+void*
+arenaGrow (struct Arena* arena, void* ptr, size_t size);
+
+/** Free memory and everything that was allocated after it from an arena.
+ * @param arena the memory arena
+ * @param ptr   memory returned by arenaAlloc() or arenaGrow(), or NULL
+ */
+void
+arenaFree (struct Arena* arena, void* ptr);
+
+/** Free all memory of an arena.
+ * @param arena the memory arena
+ */
+void
+arenaRelease (struct Arena* arena);
+
+/** CRC-32 and SHA-1 checksums of file contents */
+struct Checksum
+{
+  /** CRC-32 of the data so far (the final value after checksumFinal()) */
+  unsigned long crc;
+  /** SHA-1 intermediate hash value */
+  unsigned long h[5];
+  /** number of bytes processed, modulo 2**32 */
+  unsigned long lengthLow;
+  /** number of bytes processed, divided by 2**32 */
+  unsigned long lengthHigh;
+  /** incomplete SHA-1 input block */
+  byte_t block[64];
+};
+
+/** Start computing checksums
+ * @param sum         the checksum state
+ */
+void
+checksumInit (struct Checksum* sum);
+
+/** Add data to checksums
+ * @param sum         the checksum state
+ * @param data        the data
+ * @param length      number of bytes of data
+ */
+void
+checksumUpdate (struct Checksum* sum, const byte_t* data, size_t length);
+
+/** Finish computing checksums
+ * @param sum         the checksum state (sum->crc will be the CRC-32)
+ * @param sha1        (output) the SHA-1 message digest
+ */
+void
+checksumFinal (struct Checksum* sum, byte_t sha1[20]);
+
 /** Verbosity level of diagnostic output */
 enum Verbosity
 {
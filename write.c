@@ -27,9 +27,36 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#if defined HAVE_OPENDIR || defined HAVE_OPENAT
+# include <dirent.h>
+#endif
+#if defined HAVE_OPENAT || defined HAVE_O_EXCL
+# include <fcntl.h>
+# ifdef _WIN32
+#  include <io.h>
+# else
+#  include <unistd.h>
+# endif
+#endif
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+#ifdef HAVE_WRITEV
+# include <limits.h>
+# include <sys/uio.h>
+#endif
 
 #include "output.h"
 
+#ifdef HAVE_WRITEV
+# ifdef IOV_MAX
+/** Maximum number of segments to pass to writev() */
+#  define IOVECS IOV_MAX
+# else
+#  define IOVECS 16
+# endif
+#endif
+
 /** Convert a PETSCII file name to a printable null-terminated ASCII string.
  * @param name          the PETSCII file name
  * @param newname       (output) the converted file name
@@ -202,104 +229,512 @@ filesuffix (const struct Filename* filename)
   return "";
 }
 
-/** Write data to a file
- * @param data          the contents of the file
- * @param length        length of the file contents
- * @param newname       (output) the converted file name
+/** Write the contents of a file to a stream
+ * @param f             the output stream
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @return              true on success
+ */
+bool
+WriteContents (FILE* f,
+               const struct Segment* segments,
+               size_t count)
+{
+#ifdef HAVE_WRITEV
+  struct iovec iov[IOVECS];
+  size_t skip = 0; /* number of bytes of segments[0] already written */
+
+  if (fflush (f))
+    return false;
+
+  while (count) {
+    size_t n, want;
+    ssize_t written;
+
+    for (n = want = 0; n < count && n < IOVECS; n++, skip = 0) {
+      iov[n].iov_base = (void*) (segments[n].data + skip);
+      want += iov[n].iov_len = segments[n].length - skip;
+    }
+
+    if ((written = writev (fileno (f), iov, (int) n)) < 0 ||
+        (!written && want))
+      return false;
+
+    /* skip the segments that were written completely */
+    for (skip = (size_t) written + (segments->length - iov[0].iov_len);
+         count && skip >= segments->length;
+         skip -= segments->length, segments++, count--);
+  }
+
+  return true;
+#else
+  for (; count--; segments++)
+    if (segments->length != fwrite (segments->data, 1, segments->length, f))
+      return false;
+
+  return true;
+#endif
+}
+
+#ifdef HAVE_OPENAT
+/** The directory for host files (AT_FDCWD for the current directory) */
+static int outputDir = AT_FDCWD;
+#else
+/** The directory for host files (NULL for the current directory) */
+static const char* outputDir;
+
+/** Determine the path name of a host file
+ * @param filename      the file name
+ * @return              the path name in the output directory
+ *                      (to be freed if not equal to filename),
+ *                      or NULL if out of memory
+ */
+static char*
+hostPath (const char* filename)
+{
+  char* path;
+
+  if (!outputDir)
+    return (char*) filename;
+
+  if ((path = malloc (strlen (outputDir) + strlen (filename) + 2)))
+    sprintf (path, "%s/%s", outputDir, filename);
+
+  return path;
+}
+
+#endif
+
+/** Set the directory where host files are written
+ * @param dir           the directory name
+ * @return              true on success; false with errno set on failure
+ */
+bool
+SetOutputDirectory (const char* dir)
+{
+#ifdef HAVE_OPENAT
+  int fd = open (dir, O_RDONLY), err;
+  struct stat statbuf;
+
+  if (fd < 0)
+    return false;
+
+  if (fstat (fd, &statbuf))
+    err = errno;
+  else if (!S_ISDIR (statbuf.st_mode))
+    err = ENOTDIR;
+  else {
+    if (outputDir != AT_FDCWD)
+      close (outputDir);
+    outputDir = fd;
+    return true;
+  }
+
+  close (fd);
+  errno = err;
+  return false;
+#else
+  struct stat statbuf;
+
+  if (stat (dir, &statbuf))
+    return false;
+
+  if ((statbuf.st_mode & S_IFMT) != S_IFDIR) {
+    errno = ENOTDIR;
+    return false;
+  }
+
+  outputDir = dir;
+  return true;
+#endif
+}
+
+/** Initial number of hash chains in the file name index */
+#define NAMEHASH 256
+
+/** An entry in the index of host file names */
+struct NameEntry
+{
+  /** next entry in the same hash chain */
+  struct NameEntry* chain;
+  /** hash value of the name */
+  unsigned hash;
+  /** for a name pattern, the first number that may be unused */
+  unsigned next;
+  /** flag: WriteStore() wrote the file or checked its size */
+  bool verified;
+  /** the file name, or a name pattern starting with '/' */
+  char* name;
+};
+
+/** Index of the file names in the output directory */
+static struct
+{
+  /** hash chains of the entries */
+  struct NameEntry** chains;
+  /** number of hash chains (a power of 2) */
+  size_t chainCount;
+  /** number of entries */
+  size_t count;
+  /** flag: all file names in the directory are in the index */
+  bool complete;
+} names;
+
+/** Compute the hash value of a host file name
+ * @param name  the file name
+ * @return      the hash value
+ */
+static unsigned
+hashString (const char* name)
+{
+  unsigned h = 0;
+
+  while (*name)
+    h = h * 31 + (unsigned char) *name++;
+
+  return h ^ h >> 16;
+}
+
+/** Look up or add a file name or name pattern in the index
+ * @param name          the file name or name pattern
+ * @param create        flag: add the name if it is not found
+ * @return              the index entry, or NULL if not found
+ */
+static struct NameEntry*
+findName (const char* name, bool create)
+{
+  unsigned hash = hashString (name);
+  struct NameEntry* e;
+  size_t len;
+
+  for (e = names.chains[hash & (names.chainCount - 1)]; e; e = e->chain)
+    if (e->hash == hash && !strcmp (e->name, name))
+      return e;
+
+  if (!create)
+    return 0;
+
+  /* Double the number of hash chains when they get long. */
+  if (names.count >= names.chainCount) {
+    size_t count = names.chainCount * 2, i;
+    struct NameEntry** chains = calloc (count, sizeof *chains);
+
+    if (chains) {
+      for (i = 0; i < names.chainCount; i++) {
+        while ((e = names.chains[i])) {
+          names.chains[i] = e->chain;
+          e->chain = chains[e->hash & (count - 1)];
+          chains[e->hash & (count - 1)] = e;
+        }
+      }
+
+      free (names.chains);
+      names.chains = chains;
+      names.chainCount = count;
+    }
+  }
+
+  len = strlen (name) + 1;
+
+  if (!(e = malloc (sizeof *e + len))) {
+    /* Fall back to stat() if the index cannot be kept complete. */
+    names.complete = false;
+    return 0;
+  }
+
+  e->name = memcpy (e + 1, name, len);
+  e->hash = hash;
+  e->next = 0;
+  e->verified = false;
+  e->chain = names.chains[hash & (names.chainCount - 1)];
+  names.chains[hash & (names.chainCount - 1)] = e;
+  names.count++;
+  return e;
+}
+
+/** Read the file names in the output directory to the index,
+ * unless this has already been done.
+ * @return              false if the index could not be allocated
+ */
+static bool
+loadNames (void)
+{
+  if (names.chains)
+    return true;
+
+  if (!(names.chains = calloc (NAMEHASH, sizeof *names.chains)))
+    return false;
+
+  names.chainCount = NAMEHASH;
+
+#if defined HAVE_OPENAT
+  {
+    int fd = openat (outputDir, ".", O_RDONLY);
+    DIR* dir = fd < 0 ? 0 : fdopendir (fd);
+    struct dirent* d;
+
+    if (!dir && fd >= 0)
+      close (fd);
+
+    if (dir) {
+      names.complete = true;
+
+      while (names.complete && (d = readdir (dir)))
+        findName (d->d_name, true);
+
+      closedir (dir);
+    }
+  }
+#elif defined HAVE_OPENDIR
+  {
+    DIR* dir = opendir (outputDir ? outputDir : ".");
+    struct dirent* d;
+
+    if (dir) {
+      names.complete = true;
+
+      while (names.complete && (d = readdir (dir)))
+        findName (d->d_name, true);
+
+      closedir (dir);
+    }
+  }
+#endif
+
+  return true;
+}
+
+/** Determine whether a host file name is in use
+ * @param filename      the file name
+ * @return              true if the file exists
+ */
+static bool
+nameTaken (const char* filename)
+{
+  struct stat statbuf;
+
+  if (loadNames () && names.complete)
+    return !!findName (filename, false);
+
+#ifdef HAVE_OPENAT
+  return !fstatat (outputDir, filename, &statbuf, 0);
+#else
+  {
+    char* path = hostPath (filename);
+    bool taken = path && !stat (path, &statbuf);
+
+    if (path != filename)
+      free (path);
+    return taken;
+  }
+#endif
+}
+
+/** Create a file
+ * @param file          (output) the file
+ * @param newname       the converted file name
  * @param name          native (PETSCII) name of the file
  * @param log           Call-back function for diagnostic output
  * @return              status of the operation
+ *                      (WrFileExists if the file was created meanwhile)
  */
 static enum WrStatus
-do_it (const byte_t* data,
-       size_t length,
-       char** newname,
-       const struct Filename* name,
-       log_t log)
+do_open (FILE** file,
+         const char* newname,
+         const struct Filename* name,
+         log_t log)
 {
-  FILE* f;
+#ifdef HAVE_OPENAT
+  /* Create the file atomically, failing if the name is in use. */
+  int fd = openat (outputDir, newname, O_WRONLY | O_CREAT | O_EXCL, 0666);
 
-  if (!(f = fopen (*newname, "wb"))) {
-    (*log) (Errors, name, "fopen: %s", strerror (errno));
+  if (fd < 0) {
+    if (errno == EEXIST) {
+      if (names.chains)
+        findName (newname, true);
+      return WrFileExists;
+    }
+
+    (*log) (Errors, name, "open: %s", strerror (errno));
     return errno == ENOSPC ? WrNoSpace : WrFail;
   }
 
-  if (length != fwrite (data, 1, length, f)) {
-    (*log) (Errors, name, "fwrite: %s", strerror (errno));
-    fclose (f);
+  if (!(*file = fdopen (fd, "wb"))) {
+    (*log) (Errors, name, "fdopen: %s", strerror (errno));
+    close (fd);
+    return WrFail;
+  }
+#else
+  char* path = hostPath (newname);
+# ifdef HAVE_O_EXCL
+  int fd;
+# endif
+
+  if (!path) {
+    (*log) (Errors, name, "Out of memory.");
+    return WrFail;
+  }
+
+  /* Trust the index only as far as exclusive creation allows. */
+# ifdef HAVE_O_EXCL
+  if (!names.complete)
+    *file = fopen (path, "wb");
+  else if ((fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+                       0666)) < 0)
+    *file = 0;
+  else if (!(*file = fdopen (fd, "wb"))) {
+    int err = errno;
+    close (fd);
+    errno = err;
+  }
+# else
+  *file = fopen (path, "wb");
+# endif
+
+  if (path != newname)
+    free (path);
+
+  if (!*file) {
+    if (errno == EEXIST && names.complete) {
+      findName (newname, true);
+      return WrFileExists;
+    }
+
+    (*log) (Errors, name, "fopen: %s", strerror (errno));
     return errno == ENOSPC ? WrNoSpace : WrFail;
   }
+#endif
 
-  fclose (f);
+  if (names.chains)
+    findName (newname, true);
 
   return WrOK;
 }
 
-/** Write a file in raw format
+/** Create a file with the first unused numbered name
+ * @param file          (output) the file
+ * @param filename      buffer for the file name, starting with its prefix
+ *                      (truncated to the prefix if all numbers are in use)
+ * @param length        length of the prefix
+ * @param format        printf format of the number
+ * @param tail          the rest of the file name
+ * @param limit         number of available numbers
+ * @param name          native (PETSCII) name of the file
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ */
+static enum WrStatus
+do_open_numbered (FILE** file,
+                  char* filename,
+                  size_t length,
+                  const char* format,
+                  const char* tail,
+                  unsigned limit,
+                  const struct Filename* name,
+                  log_t log)
+{
+  struct NameEntry* pattern = 0;
+  unsigned i = 0;
+
+  /* Resume from where the previous file of the same pattern was created,
+     so that the numbers below it need not be tried again. */
+  if (loadNames ()) {
+    char* key = malloc (length + strlen (format) + strlen (tail) + 2);
+
+    if (key) {
+      key[0] = '/';
+      memcpy (key + 1, filename, length);
+      strcpy (key + 1 + length, format);
+      strcat (key, tail);
+
+      if ((pattern = findName (key, true)))
+        i = pattern->next;
+
+      free (key);
+    }
+  }
+
+  for (; i < limit; i++) {
+    enum WrStatus status;
+
+    sprintf (filename + length, format, i);
+    strcat (filename, tail);
+
+    if (nameTaken (filename) ||
+        (status = do_open (file, filename, name, log)) == WrFileExists)
+      continue;
+
+    if (pattern)
+      pattern->next = status == WrOK ? i + 1 : i;
+
+    return status;
+  }
+
+  if (pattern)
+    pattern->next = limit;
+
+  filename[length] = 0;
+  (*log) (Errors, name, "out of file name space");
+  return WrFail;
+}
+
+/** Create a file in raw format
  * @param name          native (PETSCII) name of the file
- * @param data          the contents of the file
- * @param length        length of the file contents
+ * @param file          (output) the file, positioned at its contents
  * @param newname       (output) the converted file name
  * @param log           Call-back function for diagnostic output
  * @return              status of the operation
  */
 enum WrStatus
-WriteNative (const struct Filename* name,
-             const byte_t* data,
-             size_t length,
-             char** newname,
-             log_t log)
+OpenNative (const struct Filename* name,
+            FILE** file,
+            char** newname,
+            log_t log)
 {
-  struct stat statbuf;
+  enum WrStatus status;
   char* filename;
-  int i;
+  size_t length;
 
   if (!filename2char (name, newname))
     return WrFail;
 
-  if (!(filename = malloc (strlen (*newname) + (4 + 5 + 1))))
-    goto Fail;
+  if (!(filename = malloc ((length = strlen (*newname)) + (4 + 5 + 1))))
+    return WrFail;
 
   /* try the plain filename */
   sprintf (filename, "%s%.4s", *newname, filesuffix (name));
 
-  if (stat (filename, &statbuf)) {
-  FoundName:
-    free (*newname);
-    *newname = filename;
-    return do_it (data, length, newname, name, log);
-  }
+  if (nameTaken (filename) ||
+      (status = do_open (file, filename, name, log)) == WrFileExists)
+    status = do_open_numbered (file, filename, length, "~%u",
+                               filesuffix (name), 10000, name, log);
 
-  for (i = 0; i < 10000; i++) {
-    sprintf (filename, "%s~%d%.4s", *newname, i, filesuffix (name));
-    if (stat (filename, &statbuf))
-      goto FoundName;
+  if (status != WrOK && !filename[length]) {
+    free (filename);
+    return status;
   }
 
-  (*log) (Errors, name, "out of file name space");
- Fail:
-  free (filename);
-  return WrFail;
+  free (*newname);
+  *newname = filename;
+  return status;
 }
 
-/** Write a file in PC64 format (.P00, .S00 etc.)
+/** Create a file in PC64 format (.P00, .S00 etc.)
  * @param name          native (PETSCII) name of the file
- * @param data          the contents of the file
- * @param length        length of the file contents
+ * @param file          (output) the file, positioned at its contents
  * @param newname       (output) the converted file name
  * @param log           Call-back function for diagnostic output
  * @return              status of the operation
  */
 enum WrStatus
-WritePC64 (const struct Filename* name,
-           const byte_t* data,
-           size_t length,
-           char** newname,
-           log_t log)
+OpenPC64 (const struct Filename* name,
+          FILE** file,
+          char** newname,
+          log_t log)
 {
-  char* filename,* c;
-  int i;
-  struct stat statbuf;
+  enum WrStatus status;
+  char* filename;
+  size_t length;
 
   if (!filename2char (name, newname))
     return WrFail;
@@ -307,89 +742,298 @@ WritePC64 (const struct Filename* name,
   if (!(filename = malloc (TruncateName ((unsigned char*)*newname) + 4 + 1)))
     return WrFail;
 
-  i = sprintf (filename, "%s%.4s", *newname, filesuffix (name));
+  length = (size_t) sprintf (filename, "%s%.4s", *newname, filesuffix (name));
 
   if (name->type == REL) /* Fix the suffix for relative files */
-    filename[i - 3] = 'r';
-
-  c = &filename[i - 2];
+    filename[length - 3] = 'r';
 
-  for (i = 0; i < 100; i++) {
-    sprintf (c, "%02d", i);
-    if (stat (filename, &statbuf)) { /* found an available file name */
-      FILE* f;
+  status = do_open_numbered (file, filename, length - 2, "%02u", "", 100,
+                             name, log);
 
-      free (*newname);
-      *newname = filename;
-
-      if (!(f = fopen (*newname, "wb"))) {
-        (*log) (Errors, name, "fopen: %s", strerror (errno));
-        return errno == ENOSPC ? WrNoSpace : WrFail;
-      }
+  if (status != WrOK && !filename[length - 2]) {
+    free (filename);
+    return status;
+  }
 
-      if (1 != fwrite ("C64File", 8, 1, f) ||
-          1 != fwrite (name->name, 16, 1, f) ||
-          EOF == fputc (0, f) ||
-          EOF == fputc (name->recordLength, f) ||
-          length != fwrite (data, 1, length, f)) {
-        (*log) (Errors, name, "fwrite: %s", strerror (errno));
-        fclose (f);
-        return errno == ENOSPC ? WrNoSpace : WrFail;
-      }
+  free (*newname);
+  *newname = filename;
 
-      fclose (f);
+  if (status != WrOK)
+    return status;
 
-      return WrOK;
-    }
+  if (1 != fwrite ("C64File", 8, 1, *file) ||
+      1 != fwrite (name->name, 16, 1, *file) ||
+      EOF == fputc (0, *file) ||
+      EOF == fputc (name->recordLength, *file)) {
+    (*log) (Errors, name, "fwrite: %s", strerror (errno));
+    fclose (*file);
+    return errno == ENOSPC ? WrNoSpace : WrFail;
   }
 
-  free (filename);
-  (*log) (Errors, name, "out of file name space");
-  return WrFail;
+  return WrOK;
 }
 
-/** Write a file in raw format, using ISO 9660 compliant filenames
+/** Create a file in raw format, using ISO 9660 compliant filenames
  * @param name          native (PETSCII) name of the file
- * @param data          the contents of the file
- * @param length        length of the file contents
+ * @param file          (output) the file, positioned at its contents
  * @param newname       (output) the converted file name
  * @param log           Call-back function for diagnostic output
  * @return              status of the operation
  */
 enum WrStatus
-Write9660 (const struct Filename* name,
-           const byte_t* data,
-           size_t length,
-           char** newname,
-           log_t log)
+Open9660 (const struct Filename* name,
+          FILE** file,
+          char** newname,
+          log_t log)
 {
+  enum WrStatus status;
   char* filename;
-  unsigned i;
-  struct stat statbuf;
+  size_t length;
 
   if (!filename2char (name, newname))
     return WrFail;
 
-  if (!(filename = malloc (TruncateName ((unsigned char*)*newname) + 4 + 1)))
+  if (!(filename = malloc ((length = TruncateName ((unsigned char*)*newname))
+                           + 4 + 1)))
     return WrFail;
 
   /* try the basic file name */
   sprintf (filename, "%s%.4s", *newname, filesuffix (name));
-  if (stat (filename, &statbuf)) {
-  FoundName:
-    free (*newname);
-    *newname = filename;
-    return do_it (data, length, newname, name, log);
-  }
 
   /* try with .000-style file names */
-  for (i = 0; i < 1000; i++) {
-    sprintf (filename, "%s.%03u", *newname, i);
-    if (stat (filename, &statbuf))
-      goto FoundName;
+  if (nameTaken (filename) ||
+      (status = do_open (file, filename, name, log)) == WrFileExists)
+    status = do_open_numbered (file, filename, length, ".%03u", "", 1000,
+                               name, log);
+
+  if (status != WrOK && !filename[length]) {
+    free (filename);
+    return status;
   }
 
-  free (filename);
-  (*log) (Errors, name, "out of file name space");
-  return WrFail;
+  free (*newname);
+  *newname = filename;
+  return status;
+}
+
+/** Determine whether a host file exists and has the expected size
+ * @param filename      the file name
+ * @param length        the expected size in bytes
+ * @return              true if the file exists with that size
+ */
+static bool
+hasSize (const char* filename, size_t length)
+{
+  struct stat statbuf;
+#ifdef HAVE_OPENAT
+  if (fstatat (outputDir, filename, &statbuf, 0))
+    return false;
+#else
+  char* path = hostPath (filename);
+  bool found = path && !stat (path, &statbuf);
+
+  if (path != filename)
+    free (path);
+  if (!found)
+    return false;
+#endif
+  return S_ISREG (statbuf.st_mode) && (size_t) statbuf.st_size == length;
+}
+
+/** Rename a host file, replacing any existing file of the new name
+ * @param from          the old file name
+ * @param to            the new file name
+ * @return              true on success; false with errno set on failure
+ */
+static bool
+renameHost (const char* from, const char* to)
+{
+#ifdef HAVE_OPENAT
+  return !renameat (outputDir, from, outputDir, to);
+#else
+  char* fromPath = hostPath (from);
+  char* toPath = hostPath (to);
+  bool renamed = false;
+
+  if (!fromPath || !toPath)
+    errno = ENOMEM;
+  /* rename() may refuse to replace an existing file (on Windows). */
+  else if (!(renamed = !rename (fromPath, toPath)) && !remove (toPath))
+    renamed = !rename (fromPath, toPath);
+
+  if (fromPath && fromPath != from)
+    free (fromPath);
+  if (toPath && toPath != to)
+    free (toPath);
+  return renamed;
+#endif
+}
+
+/** Remove a host file
+ * @param filename      the file name
+ * @return              true on success; false with errno set on failure
+ */
+static bool
+removeHost (const char* filename)
+{
+#ifdef HAVE_OPENAT
+  return !unlinkat (outputDir, filename, 0);
+#else
+  char* path = hostPath (filename);
+  bool removed;
+
+  if (!path) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  removed = !remove (path);
+
+  if (path != filename)
+    free (path);
+  return removed;
+#endif
+}
+
+/** Create a temporary file that is not in the name index
+ * @param file          (output) the file
+ * @param tmpname       the file name
+ * @param name          native (PETSCII) name of the file
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ *                      (WrFileExists if the name is in use)
+ */
+static enum WrStatus
+openTemporary (FILE** file,
+               const char* tmpname,
+               const struct Filename* name,
+               log_t log)
+{
+#if defined HAVE_OPENAT || defined HAVE_O_EXCL
+  int fd;
+# ifdef HAVE_OPENAT
+  fd = openat (outputDir, tmpname, O_WRONLY | O_CREAT | O_EXCL, 0666);
+# else
+  char* path = hostPath (tmpname);
+
+  if (!path) {
+    (*log) (Errors, name, "Out of memory.");
+    return WrFail;
+  }
+
+  fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+
+  if (path != tmpname)
+    free (path);
+# endif
+
+  if (fd < 0) {
+    if (errno == EEXIST)
+      return WrFileExists;
+
+    (*log) (Errors, name, "open: %s", strerror (errno));
+    return errno == ENOSPC ? WrNoSpace : WrFail;
+  }
+
+  if (!(*file = fdopen (fd, "wb"))) {
+    (*log) (Errors, name, "fdopen: %s", strerror (errno));
+    close (fd);
+    return WrFail;
+  }
+#else
+  char* path = hostPath (tmpname);
+
+  if (!path) {
+    (*log) (Errors, name, "Out of memory.");
+    return WrFail;
+  }
+
+  *file = fopen (path, "wb");
+
+  if (path != tmpname)
+    free (path);
+
+  if (!*file) {
+    (*log) (Errors, name, "fopen: %s", strerror (errno));
+    return errno == ENOSPC ? WrNoSpace : WrFail;
+  }
+#endif
+
+  return WrOK;
+}
+
+/** Write a file to a content-addressed store, unless it is there already
+ * @param key           the host file name, derived from the contents
+ * @param segments      the contents of the file
+ * @param count         number of segments
+ * @param length        total length of the file contents
+ * @param name          native (PETSCII) name of the file
+ * @param log           Call-back function for diagnostic output
+ * @return              status of the operation
+ *                      (WrFileExists if the contents were already stored)
+ */
+enum WrStatus
+WriteStore (const char* key,
+            const struct Segment* segments,
+            size_t count,
+            size_t length,
+            const struct Filename* name,
+            log_t log)
+{
+  FILE* f;
+  enum WrStatus status;
+  char* tmpname;
+  unsigned i;
+  struct NameEntry* e;
+
+  /* Replace an entry of the wrong size, such as a truncated file
+     that an interrupted run of an earlier version left behind.
+     Only check the size of each entry once. */
+  if (loadNames () && names.complete) {
+    if ((e = findName (key, false)) &&
+        (e->verified || hasSize (key, length))) {
+      e->verified = true;
+      return WrFileExists;
+    }
+  }
+  else if (hasSize (key, length))
+    return WrFileExists;
+
+  if (!(tmpname = malloc (strlen (key) + 5))) {
+    (*log) (Errors, name, "Out of memory.");
+    return WrFail;
+  }
+
+  /* Write the contents under a temporary name and rename the complete
+     file to the key, so that the key never names a partial file.
+     Remove any temporary file that an interrupted run left behind. */
+  for (i = 0, status = WrFileExists; status == WrFileExists && i < 100; i++) {
+    sprintf (tmpname, "%s.t%02u", key, i);
+    if ((status = openTemporary (&f, tmpname, name, log)) == WrFileExists &&
+        removeHost (tmpname))
+      status = openTemporary (&f, tmpname, name, log);
+  }
+
+  if (status == WrFileExists)
+    (*log) (Errors, name, "out of temporary file names");
+  else if (status == WrOK) {
+    bool written = WriteContents (f, segments, count);
+
+    if (fclose (f) || !written) {
+      (*log) (Errors, name, "fwrite: %s", strerror (errno));
+      status = errno == ENOSPC ? WrNoSpace : WrFail;
+    }
+    else if (!renameHost (tmpname, key)) {
+      (*log) (Errors, name, "rename: %s", strerror (errno));
+      status = WrFail;
+    }
+
+    if (status != WrOK)
+      removeHost (tmpname);
+    else if (names.chains && (e = findName (key, true)))
+      e->verified = true;
+  }
+
+  free (tmpname);
+  return status == WrFileExists ? WrFail : status;
 }